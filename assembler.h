@@ -0,0 +1,46 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+	library interface of the assembler. nothing behind it ends the process , every error comes back as a diagnostic ,
+	so one process can assemble any number of sources. build main.cc with -DASSEMBLER_LIBRARY to leave out main()
+	and link it into another program.
+*/
+struct assembly_diagnostic
+{
+	int line_no; // 0 when the error is not tied to a line
+	std::string message;
+};
+
+struct assembly_result
+{
+	bool ok = false;
+	unsigned short origin = 0;
+	std::vector<unsigned char> bytes;
+	std::vector<assembly_diagnostic> diagnostics;
+};
+
+// assembles source for the start point given in hex , e.g. "8000"
+assembly_result assemble_source(std::string_view source , std::string start_point = "8000");
+assembly_result assemble_file(const char *filename , std::string start_point = "8000");
+
+// keeps every statement of the last source with its tokens and bytes , an update only encodes the statements that changed
+class incremental_assembler
+{
+public:
+	explicit incremental_assembler(std::string start_point = "8000");
+	~incremental_assembler();
+	const assembly_result &update(std::string_view source);
+
+	struct state; // statements and labels , defined next to the assembler
+
+private:
+	std::unique_ptr<state> s;
+};
+
+#endif
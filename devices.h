@@ -0,0 +1,320 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "vm.h"
+
+/*
+	peripherals of the virtual machine on a device bus.
+
+	a device takes IN/OUT ports , a range of memory addresses or both. IN and OUT on its ports and writes into its
+	range call the device , the lines of the range are marked VM_LINE_DEVICE in watch_lines so any other write only
+	pays for one test. reading the range is plain memory the device keeps up to date. whatever a device does over
+	time is an event on a queue ordered by cycle : bus_run runs the cpu with vm_run or vm_run_cached up to the next
+	event and only then calls the device , so the interpreter loop is the same with or without devices. a device that
+	needs the loop left earlier (a new event that is due sooner , an interrupt) sets VM_EVENT.
+========================================================================
+	timer   : adds one to its port every period T-states and raises its interrupt
+	uart    : data at port , status at port+1 (bit 0 a byte was received , bit 1 ready to send). one byte per period
+	          T-states is read from the input file into the data port and raises the interrupt , IN of the data
+	          port takes it. OUT of the data port writes the byte to the output file and is busy for period T-states.
+	display : a latch for every address of its range (or its port) , each change is printed with its cycle
+
+	interrupts are RST 5.5 6.5 7.5 (int_pending) and are taken between runs when EI and the masks of SIM let them.
+
+	the only input from outside is what the uarts read , every byte goes into the inputs of the bus with its cycle.
+	the rest of a run follows from the program , so a bus given the inputs of an earlier run replays them instead of
+	reading the files and the run repeats exactly. a bus_snapshot keeps the position in the inputs , restoring it
+	with the machine snapshot replays the run from there , dropping the inputs after it forks a new run instead.
+*/
+
+enum DEVICE_KIND { DEVICE_TIMER , DEVICE_UART , DEVICE_DISPLAY };
+enum BUS_EVENT_KIND { EVENT_TICK , EVENT_RECEIVE , EVENT_SENT };
+
+#define IRQ_NONE -1 // else 0 for RST 5.5 , 1 for 6.5 and 2 for 7.5
+
+struct device
+{
+	DEVICE_KIND kind;
+	int port = -1; // -1 without ports
+	unsigned int first = 0 , count = 0; // memory range
+	int irq = IRQ_NONE;
+	unsigned long long period = 1000; // T-states between ticks or bytes
+	FILE *in = nullptr; // uart
+	FILE *out = nullptr; // uart and display
+	bool received = false , sending = false; // uart
+	std::vector<int> latch; // display , -1 until written
+	unsigned long long ticks = 0 , bytes_in = 0 , bytes_out = 0 , changes = 0;
+};
+
+struct bus_event
+{
+	unsigned long long when;
+	unsigned long long order; // events of the same cycle run in the order they were scheduled
+	int device;
+	BUS_EVENT_KIND kind;
+
+	bool operator>(const bus_event &e) const { return when != e.when ? when > e.when : order > e.order; }
+};
+
+struct bus_input
+{
+	unsigned long long when;
+	int device;
+	int byte; // EOF when the file ended
+};
+
+struct device_bus
+{
+	std::vector<device> devices;
+	std::priority_queue<bus_event , std::vector<bus_event> , std::greater<bus_event>> events;
+	unsigned long long order = 0;
+	unsigned long long until = 0; // end of the current run of the cpu
+	std::array<int , 256> port_device;
+	unsigned long long interrupts = 0;
+	std::vector<bus_input> inputs; // every byte received , replayed before the files are read
+	size_t next_input = 0;
+	bool diverged = false; // a replayed byte came to another device or cycle than it was recorded at
+};
+
+struct bus_snapshot
+{
+	std::vector<device> devices;
+	std::priority_queue<bus_event , std::vector<bus_event> , std::greater<bus_event>> events;
+	unsigned long long order;
+	unsigned long long interrupts;
+	size_t next_input;
+};
+
+// the cpu leaves the current run (and block) at the next instruction
+inline void bus_break(machine &m)
+{
+	if(m.status == VM_RUNNING)
+	{
+		m.status = VM_EVENT;
+		m.stop = true;
+	}
+}
+
+inline void bus_schedule(machine &m , device_bus &bus , unsigned long long when , int device , BUS_EVENT_KIND kind)
+{
+	bus.events.push({ when , bus.order++ , device , kind });
+	if(when < bus.until)
+		bus_break(m);
+}
+
+inline void bus_raise(machine &m , int irq)
+{
+	if(irq == IRQ_NONE)
+		return;
+	m.int_pending |= 1 << irq;
+	if(m.inte && !(m.int_mask & 1 << irq))
+		bus_break(m);
+}
+
+// RST 7.5 before 6.5 before 5.5 , a halted cpu goes on after HLT
+inline void bus_interrupt(machine &m , device_bus &bus)
+{
+	unsigned char ready = m.int_pending & ~m.int_mask & 0x07;
+	if(!m.inte || ready == 0)
+		return;
+	int irq = ready & 0x04 ? 2 : ready & 0x02 ? 1 : 0;
+	m.int_pending &= ~(1 << irq);
+	m.inte = false;
+	vm_push<false>(m , m.PC);
+	m.PC = 0x2C + irq * 8;
+	m.cycles += 12;
+	if(m.status == VM_HALTED)
+		m.status = VM_RUNNING;
+	bus.interrupts++;
+}
+
+// the next byte of a uart , from the inputs while there are any to replay , else from its file
+inline int bus_receive(device_bus &bus , int index , unsigned long long when)
+{
+	if(bus.next_input < bus.inputs.size())
+	{
+		const bus_input &input = bus.inputs[bus.next_input++];
+		if(input.device != index || input.when != when)
+			bus.diverged = true;
+		return input.byte;
+	}
+	FILE *in = bus.devices[index].in;
+	int c = in != nullptr ? fgetc(in) : EOF;
+	bus.inputs.push_back({ when , index , c });
+	bus.next_input++;
+	return c;
+}
+
+inline void uart_status(machine &m , const device &d)
+{
+	m.ports[(d.port + 1) & 0xFF] = (d.received ? 0x01 : 0) | (d.sending ? 0 : 0x02);
+}
+
+inline void display_latch(machine &m , device &d , unsigned int index , unsigned char v , unsigned int addr)
+{
+	if(d.latch[index] == v)
+		return;
+	d.latch[index] = v;
+	d.changes++;
+	fprintf(d.out , "display %0*X = %02X at %llu\n" , d.count > 0 ? 4 : 2 , addr , v , m.cycles);
+}
+
+inline void device_event(machine &m , device_bus &bus , int index , const bus_event &e)
+{
+	device &d = bus.devices[index];
+	switch(e.kind)
+	{
+		case EVENT_TICK :
+			m.ports[d.port]++;
+			d.ticks++;
+			bus_raise(m , d.irq);
+			bus_schedule(m , bus , e.when + d.period , index , EVENT_TICK);
+			break;
+		case EVENT_RECEIVE : {
+			if(!d.received) // else the byte waits until the last one is taken
+			{
+				int c = bus_receive(bus , index , e.when);
+				if(c == EOF)
+					break;
+				m.ports[d.port] = c;
+				d.received = true;
+				d.bytes_in++;
+				uart_status(m , d);
+				bus_raise(m , d.irq);
+			}
+			bus_schedule(m , bus , e.when + d.period , index , EVENT_RECEIVE);
+			break;
+		}
+		case EVENT_SENT :
+			d.sending = false;
+			uart_status(m , d);
+			break;
+	}
+}
+
+// io_write of the machine
+inline void bus_write(machine &m , unsigned short addr)
+{
+	device_bus &bus = *m.bus;
+	for(device &d : bus.devices)
+		if(d.kind == DEVICE_DISPLAY && addr >= d.first && addr < d.first + d.count)
+			display_latch(m , d , addr - d.first , m.memory[addr] , addr);
+}
+
+// io_port of the machine
+inline void bus_port(machine &m , unsigned char port , bool out)
+{
+	device_bus &bus = *m.bus;
+	int index = bus.port_device[port];
+	if(index < 0)
+		return;
+	device &d = bus.devices[index];
+	if(d.kind == DEVICE_DISPLAY && out)
+		display_latch(m , d , 0 , m.ports[port] , port);
+	else if(d.kind == DEVICE_UART && port == d.port)
+	{
+		if(!out && d.received)
+		{
+			d.received = false;
+			uart_status(m , d);
+		}
+		else if(out && !d.sending) // a byte sent while busy is lost like on the chip
+		{
+			fputc(m.ports[port] , d.out);
+			fflush(d.out);
+			d.bytes_out++;
+			d.sending = true;
+			uart_status(m , d);
+			bus_schedule(m , bus , m.cycles + d.period , index , EVENT_SENT);
+		}
+	}
+}
+
+// hooks the devices into the machine and schedules their first events
+inline void bus_attach(machine &m , device_bus &bus)
+{
+	m.bus = &bus;
+	m.io_write = &bus_write;
+	m.io_port = &bus_port;
+	bus.port_device.fill(-1);
+	for(int i = 0 ; i < (int)bus.devices.size() ; i++)
+	{
+		device &d = bus.devices[i];
+		if(d.port >= 0)
+			bus.port_device[d.port] = i;
+		for(unsigned int addr = d.first ; addr < d.first + d.count ; addr += 1 << VM_LINE_SHIFT)
+			m.watch_lines[addr >> VM_LINE_SHIFT] |= VM_LINE_DEVICE;
+		if(d.count > 0)
+			m.watch_lines[(d.first + d.count - 1) >> VM_LINE_SHIFT] |= VM_LINE_DEVICE;
+		if(d.kind == DEVICE_TIMER)
+			bus_schedule(m , bus , m.cycles + d.period , i , EVENT_TICK);
+		else if(d.kind == DEVICE_UART)
+		{
+			bus.port_device[(d.port + 1) & 0xFF] = i;
+			uart_status(m , d);
+			bool replayed = std::any_of(bus.inputs.begin() , bus.inputs.end() , [i](const bus_input &input) { return input.device == i; });
+			if(d.in != nullptr || replayed)
+				bus_schedule(m , bus , m.cycles + d.period , i , EVENT_RECEIVE);
+		}
+		else if(d.kind == DEVICE_DISPLAY)
+			d.latch.assign(d.count > 0 ? d.count : 1 , -1);
+	}
+}
+
+// vm_run (or vm_run_cached when cache is given) with the devices of bus , until HLT , an undefined opcode or max_cycles
+inline VM_STATUS bus_run(machine &m , device_bus &bus , block_cache *cache , unsigned long long max_cycles)
+{
+	while(m.cycles < max_cycles)
+	{
+		while(!bus.events.empty() && bus.events.top().when <= m.cycles)
+		{
+			bus_event e = bus.events.top();
+			bus.events.pop();
+			device_event(m , bus , e.device , e);
+		}
+		if(m.status == VM_EVENT)
+			m.status = VM_RUNNING;
+		bus_interrupt(m , bus);
+		unsigned long long next = bus.events.empty() ? max_cycles : std::min(max_cycles , bus.events.top().when);
+		if(m.status == VM_HALTED && m.inte && !bus.events.empty()) // HLT waits for an interrupt
+		{
+			m.cycles = std::max(m.cycles , next);
+			continue;
+		}
+		if(m.status != VM_RUNNING)
+			break;
+		bus.until = next;
+		if(cache != nullptr)
+			vm_run_cached(m , *cache , next);
+		else
+			vm_run(m , next);
+		bus.until = 0;
+	}
+	if(m.status == VM_EVENT)
+		m.status = VM_RUNNING;
+	return m.status;
+}
+
+inline bus_snapshot bus_take_snapshot(const device_bus &bus)
+{
+	return { bus.devices , bus.events , bus.order , bus.interrupts , bus.next_input };
+}
+
+// the inputs after the snapshot are replayed , bus.inputs.resize(bus.next_input) to read the files again instead
+inline void bus_restore_snapshot(device_bus &bus , const bus_snapshot &s)
+{
+	bus.devices = s.devices;
+	bus.events = s.events;
+	bus.order = s.order;
+	bus.interrupts = s.interrupts;
+	bus.next_input = s.next_input;
+	bus.until = 0;
+}
+
+#endif
@@ -3,7 +3,39 @@
 #include <array>
 #include <vector>
 #include <ctype.h>
+#include <string.h>
+#include <limits.h>
 #include <bitset>
+#include <algorithm>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <random>
+#include <string_view>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "opcodes.h"
+#include "vm.h"
+#include "devices.h"
+#include "assembler.h"
 
 // generate list of tokens <name , value > e.g <"id0", "NOP" , line_no , mem_loc> , <"id1","JMP" , line_no , mem_loc> 
 //<"DATA" , "00H" , line_no , mem_loc>
@@ -11,14 +43,12 @@
 // takes the above parser results and generates a pseudo binary code
 
 /*
-	Token list : id0 , id1 ',' , ';' , 'DATA' , 'ADDR' , A , B , C , D , E , H , L 
+	Token list : id0 , id1 ',' , ';' , 'DATA' , 'ADDR' , A , B , C , D , E , H , L , M , SP , PSW
 	
-	a keyword string array for token ID0 = [],ID1 = []
-
-	data inside keyword { name  , binary_code}
+	mnemonics are found in MNEMONIC_LIST of opcodes.h through a perfect hash
+	id0 => mnemonics without an immediate operand , id1 => mnemonics with an immediate operand
 
-	for id0 register ; we have sepprate map table of opcode where binary code redirects to the map
-	for id0 register,register ; we have sepprate map table of opcode where binary code redirects to the map
+	the opcode is the base opcode of the mnemonic with the register / pair / restart operand folded in
 ========================================================================
 
 	token structure { class_id:e_value  , "VALUE" , line_no  , mem_loc }
@@ -31,7 +61,7 @@
 	parser grammer rules
 
 	id0: ; | R,R; | R; 
-	id1: ADDR; | R,D; | D; | LABEL;
+	id1: ADDR; | R,D; | D; | LABEL; | R,ADDR; | R,LABEL;
 
 	the above are the accepted statements 
 ========================================================================
@@ -44,111 +74,298 @@
 //////////////////////////////////////////////// BASIC DATA STRUCTURES TO HOLD THE INSTRUCTION DATA ///////////////////////////
 #define BINARY_WORD_SIZE 8
 
-enum TOKEN_CLASS { ID0 , ID1 , DATA , ADDR , LABEL  , REGISTER='R' , COLON=':' , COMMA=',' , EOL=';' , SPACE=' ' , UKN=-1};
+enum TOKEN_CLASS : signed char { ID0 , ID1 , DATA , ADDR , LABEL , DIRECTIVE , STRING , REGISTER='R' , COLON=':' , COMMA=',' , EOL=';' , SPACE=' ' , UKN=-1};
 
-struct  keyword
+// the opcode tables for the whole instruction set live in opcodes.h
+
+/*=====================================STATS=========================================*/
+/*
+	--stats prints wall time , allocation count and allocated bytes of every phase with the peak RSS of the process
+	and the token , label and output byte counts. the global operator new counts every allocation , the lexer ,
+	parser and writers bump the counters and the driver marks where each phase starts. the report is printed at
+	exit so the modes that end with exit() report as well.
+	nothing is counted unless --stats set STATS.enabled (before any thread starts) , so the other modes do not share
+	the counters between their threads.
+*/
+struct phase_stat
 {
-	std::string name;
-	unsigned char binary;
-};
-
-#define MOV_MAP 0xF1
-#define ADD_MAP 0xF2
-#define MVI_MAP 0xF3
-#define JMP_MAP 0xFF
-
-std::array<keyword , 4> ID0_LIST = {{
-	{"NOP" ,  0x00},
-	{"CMA"  , 0x2F},
-	{"MOV", MOV_MAP},
-	{"ADD" , ADD_MAP}
-}};
-
-std::array<keyword , 4> ID1_LIST = {{
-	{"MVI",  MVI_MAP},
-	{"STA" , 0x32},
-	{"ADI" , 0xC6},
-	{"JMP" , JMP_MAP}
-}};
-
-std::array<std::array<unsigned char,8>,8> MOV_TABLE={{
-	{0x40,0x41,0x42,0x43,0x44,0x45,0x46,0x47},
-	{0x48,0x49,0x4A,0x4B,0x4C,0x4D,0x4E,0x4F},
-	{0x50,0x51,0x52,0x53,0x54,0x55,0x56,0x57},
-	{0x58,0x59,0x5A,0x5B,0x5C,0x5D,0x5E,0x5F},
-	{0x60,0x61,0x62,0x63,0x64,0x65,0x66,0x67},
-	{0x68,0x69,0x6A,0x6B,0x6C,0x6D,0x6E,0x6F},
-	{0x70,0x71,0x72,0x73,0x74,0x75,0x76,0x77},
-	{0x78,0x79,0x7A,0x7B,0x7C,0x7D,0x7E,0x7F},
-}};
-
-std::array<unsigned char , 8> MVI_TABLE = {0x06,0x0E,0x16,0x1E,0x26,0x2E,0x36,0x3E};
-std::array<unsigned char, 8> ADD_TABLE = {0x80,0x81,0x82,0x83,0x84,0x85,0x86,0x87};
-
-
-int get_register_pos(char reg)
-{
-	if(reg == 'A')
-		return 7;
-	else if(reg == 'M')
-		return 6;
-	else if (reg == 'L')
-		return 5;
-	else if (reg == 'H')
-		return 4;
-	else if(reg == 'E')
-		return 3;
-	else if (reg == 'D')
-		return 2;
-	else if (reg == 'C')
-		return 1;
-	else if (reg == 'B')
-		return 0;
-	else
+	const char *name;
+	double seconds;
+	size_t allocations;
+	size_t bytes;
+};
+
+struct run_stats
+{
+	bool enabled = false;
+	std::vector<phase_stat> phases;
+	std::chrono::steady_clock::time_point start;
+	size_t start_allocations = 0 , start_bytes = 0;
+	std::atomic<size_t> tokens{0} , labels{0} , output_bytes{0};
+} STATS;
+
+std::atomic<size_t> ALLOCATIONS(0) , ALLOCATED_BYTES(0);
+
+#ifndef ASSEMBLER_LIBRARY // a library has no business replacing the allocator of its host
+void *operator new(size_t size)
+{
+	if(STATS.enabled)
 	{
-		std::cout<<std::endl<<"err: the given register "<<reg<<" is not supported by architecture"<<std::endl;
-		exit(0);
+		ALLOCATIONS.fetch_add(1 , std::memory_order_relaxed);
+		ALLOCATED_BYTES.fetch_add(size , std::memory_order_relaxed);
+	}
+	if(void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+// kept out of line so the compiler does not pair the inlined free with the new expression
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p , size_t) noexcept { free(p); }
+#endif
+
+void stats_end_phase()
+{
+	if(!STATS.enabled || STATS.phases.empty())
+		return;
+	phase_stat &ph = STATS.phases.back();
+	ph.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - STATS.start).count();
+	ph.allocations = ALLOCATIONS - STATS.start_allocations;
+	ph.bytes = ALLOCATED_BYTES - STATS.start_bytes;
+}
+
+// ends the running phase and starts the next one
+void stats_phase(const char *name)
+{
+	if(!STATS.enabled)
+		return;
+	stats_end_phase();
+	STATS.phases.push_back({ name , 0 , 0 , 0 });
+	STATS.start_allocations = ALLOCATIONS;
+	STATS.start_bytes = ALLOCATED_BYTES;
+	STATS.start = std::chrono::steady_clock::now();
+}
+
+void print_stats()
+{
+	stats_end_phase();
+	char row[160];
+	snprintf(row , sizeof(row) , "%-10s %10s %12s %14s" , "phase" , "seconds" , "allocations" , "bytes");
+	std::cerr<<row<<std::endl;
+	phase_stat total = { "total" , 0 , 0 , 0 };
+	for(auto &ph : STATS.phases)
+	{
+		snprintf(row , sizeof(row) , "%-10s %10.4f %12zu %14zu" , ph.name , ph.seconds , ph.allocations , ph.bytes);
+		std::cerr<<row<<std::endl;
+		total.seconds += ph.seconds;
+		total.allocations += ph.allocations;
+		total.bytes += ph.bytes;
+	}
+	snprintf(row , sizeof(row) , "%-10s %10.4f %12zu %14zu" , total.name , total.seconds , total.allocations , total.bytes);
+	std::cerr<<row<<std::endl;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF , &usage);
+	std::cerr<<"peak rss : "<<usage.ru_maxrss<<" KB"<<std::endl;
+	std::cerr<<"tokens : "<<STATS.tokens<<" labels : "<<STATS.labels<<" output bytes : "<<STATS.output_bytes<<std::endl;
+}
+
+/*=====================================ERRORS========================================*/
+/*
+	errors never end the process where they are found , they are raised as an assembly_error. the command line
+	prints it and exits with its status , assemble_source returns it as a diagnostic.
+	given a diagnostic_list the lexer and the parser do not stop at an error , they note it , skip to the next EOL
+	and go on. the whole list is raised as assembly_errors once the source has been parsed.
+*/
+struct assembly_error
+{
+	std::string message;
+	int line_no; // 0 when the error is not tied to a line
+	int status; // exit status of the command line
+};
+
+typedef std::vector<assembly_error> diagnostic_list;
+
+struct assembly_errors
+{
+	diagnostic_list list; // in line order
+};
+
+template<typename... T>
+assembly_error make_error(int status , int line_no , const T &... parts)
+{
+	std::ostringstream message;
+	(message << ... << parts);
+	return { message.str() , line_no , status };
+}
+
+template<typename... T>
+[[noreturn]] void fail(int status , int line_no , const T &... parts)
+{
+	throw make_error(status , line_no , parts...);
+}
+
+// raises the errors noted so far
+void check_diagnostics(diagnostic_list *errors)
+{
+	if(errors == nullptr || errors->empty())
+		return;
+	std::stable_sort(errors->begin() , errors->end() , [](const assembly_error &a , const assembly_error &b) { return a.line_no < b.line_no; });
+	throw assembly_errors{ std::move(*errors) };
+}
+
+// reg is the value of a REGISTER token , line_no that of its statement
+int get_register_pos(int reg , int line_no)
+{
+	int pos = reg < REGISTER_SP ? reg : -1;
+	if(pos < 0)
+	{
+		fail(0 , line_no , "the given register " , REGISTER_NAMES[reg] , " at line " , line_no , " is not supported by architecture");
 	}
+	return pos;
+}
+
+int get_pair_pos(int reg , OPERAND_FIELD field , int line_no)
+{
+	int pos = pair_code(REGISTER_NAMES[reg] , field);
+	if(pos < 0)
+	{
+		fail(0 , line_no , "the given register pair " , REGISTER_NAMES[reg] , " at line " , line_no , " is not supported by the operation");
+	}
+	return pos;
 }
 ////////////////////////////////////////////////// /////////////////////////////////////////////////////////////////
 
 
 ///////////////////////////////////////////////// buffer builder for the file //////////////////////////////////////
-typedef std::vector<char> buffer;
-buffer readfile(char *filename)
+// the source file is memory mapped and the lexer hands out views into the mapping , nothing is copied
+struct buffer
+{
+	const char *data = nullptr;
+	size_t size = 0;
+
+	buffer() = default;
+	buffer(const buffer &) = delete;
+	buffer &operator=(const buffer &) = delete;
+	buffer(buffer &&other) : data(other.data) , size(other.size) { other.data = nullptr; other.size = 0; }
+	~buffer()
+	{
+		if(data != nullptr)
+			munmap(const_cast<char *>(data) , size);
+	}
+
+	std::string_view view() const { return std::string_view(data , size); }
+};
+
+buffer readfile(const char *filename)
 {
-	std::ifstream input(filename);
-	if (input)
+	int fd = open(filename , O_RDONLY);
+	if (fd >= 0)
 	{
-		char ch='\0';
 		buffer v;
-		while(input.get(ch))
+		struct stat st;
+		if(fstat(fd , &st) == 0 && st.st_size > 0)
 		{
-			if( ch >= 32 && ch <= 126)
-				v.push_back(ch);
+			void *p = mmap(nullptr , st.st_size , PROT_READ , MAP_PRIVATE , fd , 0);
+			if(p == MAP_FAILED)
+			{
+				fail(1 , 0 , "failed to map file " , filename);
+			}
+			madvise(p , st.st_size , MADV_SEQUENTIAL);
+			v.data = static_cast<const char *>(p);
+			v.size = st.st_size;
 		}
+		close(fd);
 		return v;
 	}
 	else
-		std::cout<<"err: No such file exist"<<std::endl;
-	exit(1);
+		fail(1 , 0 , "No such file exist");
 }
 ////////////////////////////////////////////////// bufer builder ends here /////////////////////////////////////////
 
 
 ///////////////////////////////////////////////// lexer startes here ///////////////////////////////////////////////
-struct 	token
+/*
+	identifiers are interned into a symbol arena and the token stream is kept as parallel arrays of class , value
+	and line number so the passes after the lexer only look at small integers. the value of a token is
+	ID0 , ID1   index in MNEMONIC_LIST
+	REGISTER    register code , REGISTER_SP or REGISTER_PSW
+	DATA , ADDR the number
+	LABEL       symbol id
+	STRING      symbol id of the text between the quotes
+	DIRECTIVE   one of DIRECTIVE_NAMES
+*/
+struct symbol_arena
+{
+	std::deque<std::string> names; // copies , a deque never moves them so the views in ids stay valid
+	std::unordered_map<std::string_view , int> ids; // of names[0 , indexed) , the rest is added at the next intern
+	size_t indexed = 0;
+
+	int intern(std::string_view name)
+	{
+		for( ; indexed < names.size() ; indexed++)
+			ids.emplace(names[indexed] , indexed);
+		auto it = ids.find(name);
+		if(it != ids.end())
+			return it->second;
+		names.emplace_back(name);
+		ids.emplace(names.back() , names.size() - 1);
+		indexed++;
+		return names.size() - 1;
+	}
+	// a name known to be new , the parallel lexer adds them in bulk
+	int append(std::string &&name)
+	{
+		names.push_back(std::move(name));
+		return names.size() - 1;
+	}
+	std::string_view name(int id) const { return names[id]; }
+};
+
+struct token
 {
 	TOKEN_CLASS tc;
-	std::string value;
+	int value;
 	int line_no;
 };
 
-bool is_legal_label(std::string lexem)
+struct symbol_table
+{
+	std::vector<TOKEN_CLASS> tc;
+	std::vector<int> value;
+	std::vector<int> line_no;
+	std::shared_ptr<symbol_arena> symbols = std::make_shared<symbol_arena>();
+
+	size_t size() const { return tc.size(); }
+	token operator[](size_t i) const { return { tc[i] , value[i] , line_no[i] }; }
+	// name of a LABEL or STRING token
+	std::string_view name(size_t i) const { return symbols->name(value[i]); }
+	void push_back(const token &t)
+	{
+		tc.push_back(t.tc);
+		value.push_back(t.value);
+		line_no.push_back(t.line_no);
+	}
+	void reserve(size_t n)
+	{
+		tc.reserve(n);
+		value.reserve(n);
+		line_no.reserve(n);
+	}
+	void clear() // the symbols are kept
+	{
+		tc.clear();
+		value.clear();
+		line_no.clear();
+	}
+};
+
+enum DIRECTIVE_ID { DIR_INCLUDE , DIR_EQU , DIR_MACRO , DIR_ENDM };
+constexpr std::string_view DIRECTIVE_NAMES[] = {"INCLUDE" , "EQU" , "MACRO" , "ENDM"};
+
+bool is_legal_label(std::string_view lexem)
 {
 	if(lexem[0]=='_' || isalpha(lexem[0]))
 	{
-		for(int i=1; i < lexem.size() ; i++)
+		for(size_t i=1; i < lexem.size() ; i++)
 		{
 			if(!(lexem[i]=='_' || isalpha(lexem[i]) || isdigit(lexem[i]) || lexem[i]=='-') )
 				return false;
@@ -159,53 +376,54 @@ bool is_legal_label(std::string lexem)
 }
 
 
-TOKEN_CLASS resolve_token_class(std::string lexem)
+TOKEN_CLASS resolve_token_class(std::string_view lexem)
 {
-	for(int i = 0 ; i < ID0_LIST.size() ; i++)
-	{
-		if(lexem == ID0_LIST[i].name)
-			return ID0;
-	}
-	for(int i = 0 ; i < ID1_LIST.size() ; i++)
+	int m = find_mnemonic(lexem);
+	if(m >= 0)
 	{
-		if(lexem == ID1_LIST[i].name)
-			return ID1;
+		switch(MNEMONIC_LIST[m].shape)
+		{
+			case OPS_NONE :
+			case OPS_REG :
+			case OPS_REG_REG :
+			case OPS_PAIR :
+				return ID0;
+			default :
+				return ID1;
+		}
 	}
 
-	if(lexem.size() == 1)
-	{
-		if(lexem[0] == 'A')
-			return REGISTER;
-		if(lexem[0] == 'B')
-			return REGISTER;
-		if(lexem[0] == 'C')
-			return REGISTER;
-		if(lexem[0] == 'D')
-			return REGISTER;
-		if(lexem[0] == 'E')
-			return REGISTER;
-		if(lexem[0] == 'H')
-			return REGISTER;
-		if(lexem[0] == 'L')
-			return REGISTER;
-		if(lexem[0] == 'M')
-			return REGISTER;
-	}
+	if(register_code(lexem) >= 0 || lexem == "SP" || lexem == "PSW")
+		return REGISTER;
+
+	for(auto directive : DIRECTIVE_NAMES) // handled by the preprocessor
+		if(lexem == directive)
+			return DIRECTIVE;
+
+	if(lexem.size() >= 2 && lexem.front() == '"' && lexem.back() == '"') // file name of INCLUDE
+		return STRING;
 
 	if(is_legal_label(lexem))
 	{
 		return LABEL;
 	}
 
-	if(lexem.size() == 3)
+	if(lexem.size() == 1) // restart number
 	{
-		if(isdigit(lexem[0]) && isdigit(lexem[1]) && (lexem[2] == 'H'))
+		if(isdigit(lexem[0]))
 			return DATA;
 	}
-	
-	if(lexem.size() == 5)
+
+	// 30H is data and 8000H an address , one more leading 0 lets them start with A-F : 0FFH , 0A000H
+	if(lexem.size() >= 3 && isdigit(lexem[0]) && lexem.back() == 'H' &&
+		std::all_of(lexem.begin() , lexem.end() - 1 , [](unsigned char c) { return isxdigit(c); }))
 	{
-		if(isdigit(lexem[0]) && isdigit(lexem[1]) && isdigit(lexem[2]) && isdigit(lexem[3]) && (lexem[4] == 'H'))
+		size_t digits = lexem.size() - 1;
+		if(digits % 2 == 1 && lexem[0] == '0')
+			digits--;
+		if(digits == 2)
+			return DATA;
+		if(digits == 4)
 			return ADDR;
 	}
 
@@ -215,472 +433,3853 @@ TOKEN_CLASS resolve_token_class(std::string lexem)
 
 }
 
+// value of a DATA or ADDR lexem , hex when it ends with H
+int parse_number(std::string_view lexem)
+{
+	int value = 0;
+	if(lexem.back() == 'H')
+		std::from_chars(lexem.data() , lexem.data() + lexem.size() - 1 , value , 16);
+	else
+		std::from_chars(lexem.data() , lexem.data() + lexem.size() , value , 10);
+	return value;
+}
+
 
 
 /*=================UTILITY FOR LEXER ==================================================*/
-void printTokens(std::vector<token> TOKENISED_SOURCE)
+void printTokens(const symbol_table &TOKENISED_SOURCE)
 {
-	for(int i=0 ; i < TOKENISED_SOURCE.size() ; i++)
+	for(size_t i=0 ; i < TOKENISED_SOURCE.size() ; i++)
 	{
-		std::cout<<"< "<<TOKENISED_SOURCE[i].tc<<" , "<<TOKENISED_SOURCE[i].value<<" , "<<TOKENISED_SOURCE[i].line_no<<" , "<<">"<<std::endl;
+		std::cout<<"< "<<(int)TOKENISED_SOURCE.tc[i]<<" , "<<TOKENISED_SOURCE.value[i]<<" , "<<TOKENISED_SOURCE.line_no[i]<<" , "<<">"<<std::endl;
 	}
 }
+/*======================================================================================*/
 
-void printToken(token t)
+/*==========================LEX ANALYSER CREATING SYMBOL TABLE==========================*/
+// value of the token for the lexem , identifiers are interned into the symbols of TOKENISED_SOURCE
+int token_value(symbol_table &TOKENISED_SOURCE , TOKEN_CLASS tc , std::string_view lexem)
 {
-	std::cout<<"< "<<t.tc<<" , "<<t.value<<" , "<<t.line_no<<" , "<<">"<<std::endl;
+	switch(tc)
+	{
+		case ID0 :
+		case ID1 :
+			return find_mnemonic(lexem);
+		case REGISTER :
+			return register_operand(lexem);
+		case DATA :
+		case ADDR :
+			return parse_number(lexem);
+		case STRING :
+			return TOKENISED_SOURCE.symbols->intern(lexem.substr(1 , lexem.size() - 2));
+		case DIRECTIVE :
+			return std::find(std::begin(DIRECTIVE_NAMES) , std::end(DIRECTIVE_NAMES) , lexem) - std::begin(DIRECTIVE_NAMES);
+		default :
+			return TOKENISED_SOURCE.symbols->intern(lexem);
+	}
 }
-/*======================================================================================*/
 
-/*==========================LEX ANALYSER CREATING SYMBOL TABLE==========================*/
-typedef std::vector<token> symbol_table;
-symbol_table lex_analyse_source(buffer b)
+// pushes the lexem scanned so far as a token , an unknown lexem is noted in errors and left as an UKN token
+void push_lexem(symbol_table &TOKENISED_SOURCE , std::string_view lexem , int line_no , const char *err , diagnostic_list *errors)
 {
-	symbol_table TOKENISED_SOURCE;
-	char ch=' ';
-	std::string lexem="";
-	int line_no=1;
+	TOKEN_CLASS tc = resolve_token_class(lexem); 
+	
+	if(tc == UKN)
+	{
+		if(errors == nullptr)
+			fail(0 , line_no , err , " " , lexem , " at line " , line_no);
+		errors->push_back(make_error(0 , line_no , err , " " , lexem , " at line " , line_no));
+		TOKENISED_SOURCE.push_back({ UKN , 0 , line_no });
+		return;
+	}
+
+	TOKENISED_SOURCE.push_back({ tc , token_value(TOKENISED_SOURCE , tc , lexem) , line_no });
+}
+
+/*
+	the lexer finds the delimiters 64 bytes at a time , bit i of the mask is set when p[i] is a space , a comma , a
+	colon , an EOL or not printable. the kernel is picked once from what the cpu supports.
+*/
+#define SCAN_BLOCK 64
+
+inline bool is_delimiter(unsigned char ch)
+{
+	return ch <= SPACE || ch > 126 || ch == COMMA || ch == EOL || ch == COLON;
+}
+
+uint64_t delimiter_mask_scalar(const char *p)
+{
+	uint64_t mask = 0;
+	for(int i = 0 ; i < SCAN_BLOCK ; i++)
+		if(is_delimiter(p[i]))
+			mask |= 1ULL << i;
+	return mask;
+}
 
-	for(int i = 0; i < b.size() ; i++)
+#if defined(__x86_64__) || defined(__i386__)
+// printable is 31 < c < 127 as signed bytes , the bytes from 128 up are negative and fall out as well
+uint64_t delimiter_mask_sse2(const char *p)
+{
+	const __m128i low = _mm_set1_epi8(31) , high = _mm_set1_epi8(127);
+	const __m128i space = _mm_set1_epi8(SPACE) , comma = _mm_set1_epi8(COMMA) , eol = _mm_set1_epi8(EOL) , colon = _mm_set1_epi8(COLON);
+	uint64_t mask = 0;
+	for(int k = 0 ; k < SCAN_BLOCK ; k += 16)
 	{
-		ch = b[i];
-		if(ch == SPACE) // seppration of operation to operands
-		{
-			if(lexem == "") // if nothing is being scanned then why do anything anywaw
-				continue;
-			TOKEN_CLASS tc = resolve_token_class(lexem); 
-			
-			if(tc == UKN)
-			{
-				std::cout<<std::endl<<"err: unknown token "<<lexem<<" at line "<<line_no<<std::endl;
-				exit(0);
-			}
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + k));
+		__m128i printable = _mm_and_si128(_mm_cmpgt_epi8(c , low) , _mm_cmplt_epi8(c , high));
+		__m128i delimiter = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c , space) , _mm_cmpeq_epi8(c , comma)) ,
+			_mm_or_si128(_mm_cmpeq_epi8(c , eol) , _mm_cmpeq_epi8(c , colon)));
+		delimiter = _mm_or_si128(delimiter , _mm_andnot_si128(printable , _mm_set1_epi8(-1)));
+		mask |= static_cast<uint64_t>(static_cast<unsigned int>(_mm_movemask_epi8(delimiter))) << k;
+	}
+	return mask;
+}
 
-			token t = { tc ,lexem ,line_no };
-			TOKENISED_SOURCE.push_back(t);
-			lexem="";
-			continue;
-		}
-		else if(ch == EOL) // separation of lines
-		{
-			if(lexem == "") // if nothing is being scanned then why do anything anywaw
-				continue;
-			TOKEN_CLASS tc = resolve_token_class(lexem); 
-			
-			if(tc == UKN)
-			{
-				std::cout<<std::endl<<"err: unknown token "<<lexem<<" at line "<<line_no<<std::endl;
-				exit(0);
-			}
+__attribute__((target("avx2"))) uint64_t delimiter_mask_avx2(const char *p)
+{
+	const __m256i low = _mm256_set1_epi8(31) , high = _mm256_set1_epi8(127);
+	const __m256i space = _mm256_set1_epi8(SPACE) , comma = _mm256_set1_epi8(COMMA) , eol = _mm256_set1_epi8(EOL) , colon = _mm256_set1_epi8(COLON);
+	uint64_t mask = 0;
+	for(int k = 0 ; k < SCAN_BLOCK ; k += 32)
+	{
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + k));
+		__m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(c , low) , _mm256_cmpgt_epi8(high , c));
+		__m256i delimiter = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c , space) , _mm256_cmpeq_epi8(c , comma)) ,
+			_mm256_or_si256(_mm256_cmpeq_epi8(c , eol) , _mm256_cmpeq_epi8(c , colon)));
+		delimiter = _mm256_or_si256(delimiter , _mm256_andnot_si256(printable , _mm256_set1_epi8(-1)));
+		mask |= static_cast<uint64_t>(static_cast<unsigned int>(_mm256_movemask_epi8(delimiter))) << k;
+	}
+	return mask;
+}
+#endif
 
-			token t = { tc ,lexem ,line_no };
-			TOKENISED_SOURCE.push_back(t);
-			TOKENISED_SOURCE.push_back({EOL, ";" , line_no });
-			line_no++;
-			lexem="";
-			continue;
+typedef uint64_t (*delimiter_kernel)(const char *);
+
+delimiter_kernel pick_delimiter_kernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return delimiter_mask_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return delimiter_mask_sse2;
+#endif
+	return delimiter_mask_scalar;
+}
+
+const delimiter_kernel DELIMITER_MASK = pick_delimiter_kernel();
+
+// appends the tokens of b to TOKENISED_SOURCE , line_no carries over so a source can be lexed in pieces
+void lex_analyse_chunk(std::string_view b , symbol_table &TOKENISED_SOURCE , int &line_no , diagnostic_list *errors = nullptr)
+{
+	size_t first_token = TOKENISED_SOURCE.size();
+	size_t lexem_start=0; // the lexem being scanned is b[lexem_start , i)
+
+	for(size_t block = 0 ; block < b.size() ; block += SCAN_BLOCK)
+	{
+		uint64_t mask;
+		if(block + SCAN_BLOCK <= b.size())
+			mask = DELIMITER_MASK(b.data() + block);
+		else // the last partial block is padded with delimiters that are masked off
+		{
+			char tail[SCAN_BLOCK] = {};
+			memcpy(tail , b.data() + block , b.size() - block);
+			mask = DELIMITER_MASK(tail) & ((1ULL << (b.size() - block)) - 1);
 		}
-		else if( ch == COMMA) // seppration of arguements
+		for( ; mask != 0 ; mask &= mask - 1)
 		{
-			if(lexem == "") // if nothing is being scanned then why do anything anywaw
+			size_t i = block + __builtin_ctzll(mask);
+			char ch = b[i];
+			std::string_view lexem = b.substr(lexem_start , i - lexem_start);
+			lexem_start = i+1;
+			if(lexem.empty()) // if nothing is being scanned then why do anything anywaw
 				continue;
-			TOKEN_CLASS tc = resolve_token_class(lexem); 
-			
-			if(tc == UKN)
+			push_lexem(TOKENISED_SOURCE , lexem , line_no , ch == COLON ? "bad label" : "unknown token" , errors);
+			if(ch == EOL) // separation of lines
 			{
-				std::cout<<std::endl<<"err: unknown token "<<lexem<<" at line "<<line_no<<std::endl;
-				exit(0);
+				TOKENISED_SOURCE.push_back({EOL , 0 , line_no });
+				line_no++;
 			}
-
-			token t = { tc ,lexem ,line_no };
-			TOKENISED_SOURCE.push_back(t);
-			TOKENISED_SOURCE.push_back({COMMA , "," , line_no });
-			lexem="";
-			continue;	
+			else if(ch == COMMA) // seppration of arguements
+				TOKENISED_SOURCE.push_back({COMMA , 0 , line_no });
+			else if(ch == COLON) // labels
+				TOKENISED_SOURCE.push_back({COLON , 0 , line_no });
 		}
-		else if( ch == COLON) // labels
+	}
+	STATS.tokens += TOKENISED_SOURCE.size() - first_token;
+}
+
+void parallel_for(int n , int threads , const std::function<void(int)> &job);
+
+/*
+	a large source is lexed on several threads. it is cut into chunks after a ';' , no lexem spans a cut and the only
+	state carried from one statement to the next is line_no , which goes up at every EOL token (a ';' right after a
+	lexem). the EOL tokens of every chunk are counted first and their prefix sum is the line each chunk starts at ,
+	so the chunks are lexed with their real lines and messages. names are interned into an arena per chunk , then
+	into the arena of the source chunk after chunk , which gives them the ids one thread would have given. which
+	chunk has the first of every name is found on all threads , each thread takes the names of one hash shard.
+*/
+#define LEX_PARALLEL_BYTES (1 << 20) // smaller sources are lexed on one thread
+#define LEX_CHUNK_BYTES (256 << 10)
+
+// the EOL tokens lex_analyse_chunk makes of b , b starts after a delimiter
+int count_statements(std::string_view b)
+{
+	int count = 0;
+	for(size_t i = b.find(EOL) ; i != std::string_view::npos ; i = b.find(EOL , i + 1))
+		if(i > 0 && !is_delimiter(b[i - 1]))
+			count++;
+	return count;
+}
+
+symbol_table lex_analyse_parallel(std::string_view b , int threads , diagnostic_list *errors)
+{
+	std::vector<size_t> cuts = { 0 }; // chunk k is b[cuts[k] , cuts[k+1])
+	size_t size = std::max<size_t>(LEX_CHUNK_BYTES , b.size() / (threads * 4));
+	while(cuts.back() < b.size())
+	{
+		size_t end = cuts.back() + size >= b.size() ? std::string_view::npos : b.find(EOL , cuts.back() + size);
+		cuts.push_back(end == std::string_view::npos ? b.size() : end + 1);
+	}
+	int n = cuts.size() - 1;
+	auto chunk = [&](int k) { return b.substr(cuts[k] , cuts[k + 1] - cuts[k]); };
+
+	std::vector<int> first_line(n + 1 , 1);
+	parallel_for(n , threads , [&](int k) { first_line[k + 1] = count_statements(chunk(k)); });
+	for(int k = 0 ; k < n ; k++)
+		first_line[k + 1] += first_line[k];
+
+	std::vector<symbol_table> tables(n);
+	std::vector<diagnostic_list> chunk_errors(n);
+	parallel_for(n , threads , [&](int k) {
+		int line_no = first_line[k];
+		tables[k].reserve(chunk(k).size() / 3);
+		lex_analyse_chunk(chunk(k) , tables[k] , line_no , &chunk_errors[k]);
+	});
+	for(auto &list : chunk_errors)
+		for(auto &e : list)
 		{
-			if(lexem == "") // if nothing is being scanned then why do anything anywaw
-				continue;
-			TOKEN_CLASS tc = resolve_token_class(lexem); 
-			
-			if(tc == UKN)
-			{
-				std::cout<<std::endl<<"err: bad label "<<lexem<<" at line "<<line_no<<std::endl;
-				exit(0);
-			}
+			if(errors == nullptr) // the first error stops the lexer like on one thread
+				throw e;
+			errors->push_back(std::move(e));
+		}
 
-			token t = { tc ,lexem ,line_no };
-			TOKENISED_SOURCE.push_back(t);
-			TOKENISED_SOURCE.push_back({COLON , ":" , line_no });
-			lexem="";
-			continue;
+	// first[k][i] is the chunk and id where name i of chunk k is seen first
+	std::vector<std::vector<size_t>> shard(n);
+	std::vector<std::vector<std::pair<int , int>>> first(n);
+	parallel_for(n , threads , [&](int k) {
+		for(const std::string &name : tables[k].symbols->names)
+			shard[k].push_back(std::hash<std::string_view>()(name) % threads);
+		first[k].resize(shard[k].size());
+	});
+	parallel_for(threads , threads , [&](int s) {
+		std::unordered_map<std::string_view , std::pair<int , int>> seen;
+		for(int k = 0 ; k < n ; k++)
+			for(size_t i = 0 ; i < shard[k].size() ; i++)
+				if(shard[k][i] == (size_t)s)
+					first[k][i] = seen.emplace(tables[k].symbols->names[i] , std::make_pair(k , (int)i)).first->second;
+	});
+
+	symbol_table TOKENISED_SOURCE;
+	std::vector<size_t> offset(n + 1 , 0);
+	std::vector<std::vector<int>> renumber(n); // id in the chunk => id in the source
+	for(int k = 0 ; k < n ; k++)
+	{
+		offset[k + 1] = offset[k] + tables[k].size();
+		renumber[k].resize(first[k].size());
+		for(size_t i = 0 ; i < first[k].size() ; i++)
+		{
+			auto [at , id] = first[k][i];
+			renumber[k][i] = at == k ? TOKENISED_SOURCE.symbols->append(std::move(tables[k].symbols->names[i])) : renumber[at][id];
 		}
-		lexem+=ch;
 	}
+	TOKENISED_SOURCE.tc.resize(offset[n]);
+	TOKENISED_SOURCE.value.resize(offset[n]);
+	TOKENISED_SOURCE.line_no.resize(offset[n]);
+	parallel_for(n , threads , [&](int k) {
+		const symbol_table &t = tables[k];
+		std::copy(t.tc.begin() , t.tc.end() , TOKENISED_SOURCE.tc.begin() + offset[k]);
+		std::copy(t.line_no.begin() , t.line_no.end() , TOKENISED_SOURCE.line_no.begin() + offset[k]);
+		for(size_t i = 0 ; i < t.size() ; i++)
+			TOKENISED_SOURCE.value[offset[k] + i] = t.tc[i] == LABEL || t.tc[i] == STRING ? renumber[k][t.value[i]] : t.value[i];
+		tables[k] = symbol_table();
+	});
+	return TOKENISED_SOURCE;
+}
+
+symbol_table lex_analyse_source(std::string_view b , diagnostic_list *errors = nullptr , int threads = 1)
+{
+	if(threads > 1 && b.size() >= LEX_PARALLEL_BYTES)
+		return lex_analyse_parallel(b , threads , errors);
+	symbol_table TOKENISED_SOURCE;
+	TOKENISED_SOURCE.reserve(b.size() / 3);
+	int line_no=1;
+	lex_analyse_chunk(b , TOKENISED_SOURCE , line_no , errors);
 	// printTokens(TOKENISED_SOURCE);
 	return TOKENISED_SOURCE;
 }
 /////////////////////////////////////////////////// lexer ends here /////////////////////////////////////////////////////
 
-/*=============================================PARSER FOR THE SYMBOL TABLE=============================================*/
-struct LABEL_TABLE_ENTRY
+/*==================================PREPROCESSOR=====================================*/
+/*
+	runs on the tokens between the lexer and the parser , only when the source uses a directive.
+
+	INCLUDE "file";             the tokens of file , found next to the file including it
+	NAME EQU value;             NAME is replaced by the DATA or ADDR value where it is the operand of an instruction
+	                            other than a jump or call , these take it as a label
+	NAME MACRO P1,P2;           the statements up to ENDM; are the body of NAME , NAME A,05H; expands the body
+	...                         with the parameters replaced by the arguments
+	ENDM;
+
+	an included file is read and lexed once per build and its tokens are shared by every file including it , two
+	threads including it at the same time may both read it and the first one to finish is kept.
+	the expansion of a macro with the same arguments is kept as a span of tokens and copied on every later use.
+	labels defined inside a macro body are renamed NAME@N on every copy , N counting the expansions of the source ,
+	so a body with a loop can be expanded any number of times.
+*/
+#define MAX_PREPROCESS_DEPTH 64
+
+struct include_file
 {
-	std::string LABEL_NAME;
-	int mem_loc; 
-	bool resolve; // true => the JMP statement will look for those whose resolve is true i.e needs resolving.
+	buffer source;
+	symbol_table tokens;
 };
-typedef std::vector<LABEL_TABLE_ENTRY> label_table; 
-typedef std::vector<std::string> binarySource;
-/*===========UTILITY STUFF FOR PRINTINTS AND STUFF*=========================*/
 
-void print_binary_source(binarySource &li)
+// shared by every source of a build , possibly from several threads
+struct include_cache
 {
-	std::cout<<std::endl;
-	for(int i=0 ; i < li.size() ; i++)
+	std::mutex lock;
+	std::unordered_map<std::string , std::unique_ptr<include_file>> files; // keyed by the real path
+};
+
+struct macro_def
+{
+	std::vector<int> params; // symbol ids
+	std::vector<token> body;
+};
+
+struct macro_expansion
+{
+	size_t start , count; // span of expanded
+	std::vector<int> labels; // defined in the span , renamed on every copy
+};
+
+struct preprocessor
+{
+	include_cache *includes;
+	std::shared_ptr<symbol_arena> symbols; // symbols of the output , the tokens handled are moved to them
+	std::unordered_map<int , token> equates;
+	std::unordered_map<int , macro_def> macros;
+	std::unordered_map<std::string , macro_expansion> expansions; // macro and arguments => expansion
+	std::vector<token> expanded;
+	int expansion_count = 0;
+};
+
+bool has_directives(const symbol_table &tokens)
+{
+	return std::find(tokens.tc.begin() , tokens.tc.end() , DIRECTIVE) != tokens.tc.end();
+}
+
+std::string directory_of(std::string filename)
+{
+	size_t slash = filename.find_last_of('/');
+	return slash == std::string::npos ? "." : filename.substr(0 , slash);
+}
+
+const include_file &load_include(include_cache &cache , std::string path , int line_no)
+{
+	char real[PATH_MAX];
+	if(realpath(path.c_str() , real) == nullptr)
+		fail(1 , line_no , "cannot include " , path , " at line " , line_no);
 	{
-		std::cout<<i<<" : "<<li[i]<<std::endl;
+		std::lock_guard<std::mutex> guard(cache.lock);
+		auto it = cache.files.find(real);
+		if(it != cache.files.end())
+			return *it->second;
 	}
+	// read and lexed without the lock so other threads go on with their own files
+	std::unique_ptr<include_file> loaded(new include_file{ readfile(real) , {} });
+	loaded->tokens = lex_analyse_source(loaded->source.view());
+	std::lock_guard<std::mutex> guard(cache.lock);
+	auto &file = cache.files[real];
+	if(!file) // else another thread loaded it meanwhile
+		file = std::move(loaded);
+	return *file;
 }
 
-/*==========================================================================*/
-
-// gets the code from the binary code tables based on which class of ID it is 
-unsigned char getCode(std::string operation , TOKEN_CLASS tc)
+// the tokens of t with their symbol ids moved to the symbols of pp
+std::vector<token> import_tokens(const symbol_table &t , preprocessor &pp)
 {
-	if(tc == ID0)
-		for(int i=0 ; i < ID0_LIST.size() ; i++)
-		{
-			if(ID0_LIST[i].name == operation)
-				return ID0_LIST[i].binary;
-		}
-	if(tc == ID1)
-		for(int i=0 ; i < ID1_LIST.size() ; i++)
-		{
-			if(ID1_LIST[i].name == operation)
-				return ID1_LIST[i].binary;
-		}
-	std::cout<<std::endl<<"err: cant find opecode for "<<operation<<std::endl;
-	exit(0);
+	std::vector<int> ids;
+	if(t.symbols != pp.symbols)
+		for(auto &name : t.symbols->names)
+			ids.push_back(pp.symbols->intern(name));
+	std::vector<token> out(t.size());
+	for(size_t i = 0 ; i < t.size() ; i++)
+	{
+		out[i] = t[i];
+		if(!ids.empty() && (t.tc[i] == LABEL || t.tc[i] == STRING))
+			out[i].value = ids[t.value[i]];
+	}
+	return out;
 }
 
+// jumps and calls take a label operand , the other address instructions (LDA , STA , LHLD , SHLD) a value
+bool takes_label(const token &t)
+{
+	if(t.tc != ID0 && t.tc != ID1)
+		return false;
+	const mnemonic_def &d = MNEMONIC_LIST[t.value];
+	return d.shape == OPS_ADDR && d.base >= 0xC0;
+}
 
+// an operand naming an equate becomes its value
+token substitute(const preprocessor &pp , const token &t)
+{
+	if(t.tc == LABEL)
+	{
+		auto it = pp.equates.find(t.value);
+		if(it != pp.equates.end())
+			return { it->second.tc , it->second.value , t.line_no };
+	}
+	return t;
+}
 
-binarySource parse_symbol_table(symbol_table symt , std::string start_point)
+bool is_directive(const token &t , DIRECTIVE_ID directive)
 {
-	/*
-		LABEL: COLON ID0 | COLON ID1
-		ID0: ; | R,R; | R; 
-		ID1: ADDR; | R,D; | D; | LABEL;
-	*/
+	return t.tc == DIRECTIVE && t.value == directive;
+}
 
-	
-	label_table LABEL_TABLE;
-	binarySource TRANSLATED_SOURCE;
+void preprocess_tokens(const token *begin , const token *end , preprocessor &pp , std::string dir , symbol_table &out , int depth);
 
-	int state=0;
-	int look_back=0;
-	int mem_loc=0;
+// appends the expansion of a macro , the first expansion with given arguments is kept for the later ones
+void expand_macro(const token &name , const std::vector<token> &args , preprocessor &pp , std::string dir , symbol_table &out , int depth)
+{
+	const macro_def &m = pp.macros.at(name.value);
+	if(args.size() != m.params.size())
+		fail(0 , name.line_no , "macro " , pp.symbols->name(name.value) , " at line " , name.line_no , " takes " , m.params.size() , " arguments");
+	std::string key;
+	auto put = [&](int v) { key.append(reinterpret_cast<const char *>(&v) , sizeof(v)); };
+	put(name.value);
+	for(auto &arg : args)
+	{
+		put(arg.tc);
+		put(arg.value);
+	}
+	auto it = pp.expansions.find(key);
+	if(it == pp.expansions.end())
+	{
+		std::vector<token> body;
+		body.reserve(m.body.size());
+		for(const token &t : m.body)
+		{
+			size_t k = 0;
+			while(k < m.params.size() && !(t.tc == LABEL && t.value == m.params[k]))
+				k++;
+			body.push_back(k < m.params.size() ? args[k] : t);
+		}
+		symbol_table result;
+		result.symbols = pp.symbols;
+		preprocess_tokens(body.data() , body.data() + body.size() , pp , dir , result , depth + 1);
+		macro_expansion e{ pp.expanded.size() , result.size() , {} };
+		for(size_t k = 0 ; k < result.size() ; k++)
+		{
+			if(result.tc[k] == LABEL && k + 1 < result.size() && result.tc[k+1] == COLON)
+				e.labels.push_back(result.value[k]);
+			pp.expanded.push_back(result[k]);
+		}
+		it = pp.expansions.emplace(key , std::move(e)).first;
+	}
+	const macro_expansion &e = it->second;
+	std::unordered_map<int , int> renamed;
+	if(!e.labels.empty())
+	{
+		std::string suffix = "@" + std::to_string(++pp.expansion_count);
+		for(int label : e.labels)
+			renamed[label] = pp.symbols->intern(std::string(pp.symbols->name(label)) + suffix);
+	}
+	for(size_t k = 0 ; k < e.count ; k++)
+	{
+		token t = pp.expanded[e.start + k];
+		t.line_no = name.line_no; // errors point at the use of the macro
+		if(t.tc == LABEL && !renamed.empty())
+		{
+			auto r = renamed.find(t.value);
+			if(r != renamed.end())
+				t.value = r->second;
+		}
+		out.push_back(t);
+	}
+}
 
-	for(int i = 0 ; i < symt.size() ; i++)
+void preprocess_tokens(const token *begin , const token *end , preprocessor &pp , std::string dir , symbol_table &out , int depth)
+{
+	if(depth > MAX_PREPROCESS_DEPTH)
+		fail(0 , begin < end ? begin->line_no : 0 , "includes or macros nested too deep at line " , begin < end ? begin->line_no : 0);
+	for(const token *stmt = begin ; stmt < end ; )
 	{
-		mem_loc = TRANSLATED_SOURCE.size(); 
-		switch(state)
+		const token *eol = stmt;
+		while(eol < end && eol->tc != EOL)
+			eol++;
+		const token *next = eol < end ? eol + 1 : end;
+		size_t n = eol - stmt;
+		int line_no = stmt->line_no;
+
+		if(n == 2 && is_directive(stmt[0] , DIR_INCLUDE) && stmt[1].tc == STRING && !pp.symbols->name(stmt[1].value).empty())
 		{
-			case 0 : {
-				if(symt[i].tc == ID0 || symt[i].tc == ID1) // ID0 => S1
-					state=1;
-				else if(symt[i].tc == LABEL)
-				{
-					bool found=false; // is the label already existing in the label_table
-					for(int k=0 ; k < LABEL_TABLE.size() ; k++) // iterate over the label table
-					{
-						if(LABEL_TABLE[k].LABEL_NAME == symt[i].value) // if the label is found
-						{
-							if(LABEL_TABLE[k].resolve == false) // was this label entered by a start synbol i.e by rule LABEL: ID0|ID1
-							{
-								std::cout<<"err: reuse of label "<<symt[i].value<<" for denoting jump position at line "<<symt[i].line_no<<std::endl;
-								exit(1); // if yes then exit since the label is getting used
-							}
-							// else resolve the label location in the jump statement
-							unsigned short sp= stoi(start_point , nullptr , 16); // converting 0x8000 to decimal integer
-							std::string addr = std::bitset<2*BINARY_WORD_SIZE>(sp + mem_loc).to_string();
-							// entering current location + start point in the the JMP location that created the label table entry
-							TRANSLATED_SOURCE[LABEL_TABLE[k].mem_loc+1] = addr.substr(BINARY_WORD_SIZE,BINARY_WORD_SIZE);
-							TRANSLATED_SOURCE[LABEL_TABLE[k].mem_loc+2] = addr.substr(0,BINARY_WORD_SIZE);
-							// it is resolved hence delete the entry and decrement the counter
-							// LABEL_TABLE.erase(LABEL_TABLE.begin()+k);
-							// k--;
-							found = true;
-						}
-					}
-					// if not found then the following steps to be taken
-					if(!found)
-					{	// not found i.e new label entry to be created for resolving by JMP statement
-						LABEL_TABLE.push_back({symt[i].value , mem_loc , false});
+			std::string name(pp.symbols->name(stmt[1].value));
+			std::string path = name[0] == '/' ? name : dir + "/" + name;
+			std::vector<token> tokens = import_tokens(load_include(*pp.includes , path , line_no).tokens , pp);
+			preprocess_tokens(tokens.data() , tokens.data() + tokens.size() , pp , directory_of(path) , out , depth + 1);
+		}
+		else if(n == 3 && stmt[0].tc == LABEL && is_directive(stmt[1] , DIR_EQU) && (stmt[2].tc == DATA || stmt[2].tc == ADDR))
+		{
+			if(!pp.equates.emplace(stmt[0].value , stmt[2]).second)
+				fail(1 , line_no , "reuse of name " , pp.symbols->name(stmt[0].value) , " at line " , line_no);
+			pp.expansions.clear(); // expansions made before may use the name as a label
+		}
+		else if(n >= 2 && stmt[0].tc == LABEL && is_directive(stmt[1] , DIR_MACRO))
+		{
+			std::string_view macro = pp.symbols->name(stmt[0].value);
+			macro_def m;
+			for(size_t k = 2 ; k < n ; k += 2)
+			{
+				if(stmt[k].tc != LABEL || (k+1 < n && stmt[k+1].tc != COMMA))
+					fail(0 , line_no , "bad parameter list of macro " , macro , " at line " , line_no);
+				m.params.push_back(stmt[k].value);
+			}
+			const token *body = next;
+			while(next < end && !is_directive(*next , DIR_ENDM))
+			{
+				if(is_directive(*next , DIR_MACRO))
+					fail(0 , next->line_no , "macro defined inside macro " , macro , " at line " , next->line_no);
+				next++;
+			}
+			if(next == end)
+				fail(0 , line_no , "macro " , macro , " at line " , line_no , " has no ENDM");
+			m.body.assign(body , next);
+			while(next < end && next->tc != EOL) // ENDM;
+				next++;
+			next = next < end ? next + 1 : end;
+			if(!pp.macros.emplace(stmt[0].value , std::move(m)).second)
+				fail(1 , line_no , "reuse of name " , macro , " at line " , line_no);
+		}
+		else
+		{
+			const token *t = stmt;
+			while(t + 1 < eol && t[0].tc == LABEL && t[1].tc == COLON) // label definitions in front of the statement
+			{
+				out.push_back(t[0]);
+				out.push_back(t[1]);
+				t += 2;
+			}
+			if(t < eol && t->tc == LABEL && pp.macros.count(t->value))
+			{
+				std::vector<token> args;
+				for(const token *a = t + 1 ; a < eol ; a += 2)
+				{
+					if(a + 1 < eol && a[1].tc != COMMA)
+						fail(0 , line_no , "bad arguments of macro " , pp.symbols->name(t->value) , " at line " , line_no);
+					args.push_back(*a); // equates are substituted in the body , where the position is known
+				}
+				expand_macro(*t , args , pp , dir , out , depth);
+			}
+			else
+			{
+				const token *mnemonic = t;
+				bool values = t < eol && !takes_label(*t);
+				for( ; t < next ; t++)
+				{
+					if(t->tc == DIRECTIVE)
+						fail(0 , t->line_no , "misplaced " , DIRECTIVE_NAMES[t->value] , " at line " , t->line_no);
+					out.push_back(values && t != mnemonic ? substitute(pp , *t) : *t);
+				}
+			}
+		}
+		stmt = next;
+	}
+}
+
+// tokens of a source with the directives carried out , dir is where its includes are looked for
+symbol_table preprocess_source(const symbol_table &tokens , include_cache &includes , std::string dir)
+{
+	preprocessor pp;
+	pp.includes = &includes;
+	pp.symbols = tokens.symbols;
+	symbol_table out;
+	out.symbols = tokens.symbols;
+	out.reserve(tokens.size());
+	std::vector<token> in = import_tokens(tokens , pp);
+	preprocess_tokens(in.data() , in.data() + in.size() , pp , dir , out , 0);
+	return out;
+}
+
+/*=============================================PARSER FOR THE SYMBOL TABLE=============================================*/
+struct LABEL_TABLE_ENTRY
+{
+	int mem_loc = -1; // offset of the label from the start point , -1 until the label is defined
+	int line_no = 0; // line where the label was first seen , 0 for symbols that are not labels
+};
+// indexed by the symbol id of the label
+typedef std::vector<LABEL_TABLE_ENTRY> label_table;
+// assembled bytes , bytes[i] is placed at address origin+base+i
+struct binarySource
+{
+	unsigned short origin = 0;
+	size_t base = 0; // number of bytes already flushed to the output in streaming mode
+	std::vector<unsigned char> bytes;
+	std::vector<unsigned short> labels; // addresses of the labels , the jump targets for the VM block cache
+};
+
+// where the statements and labels of the program ended up , offsets from the origin in address order
+struct program_map
+{
+	std::vector<std::pair<int , int>> lines; // offset of a statement , its line
+	std::vector<std::pair<int , std::string>> labels; // offset , name
+};
+
+struct stream_writer;
+void stream_patch(stream_writer *writer , size_t pos , unsigned char byte);
+
+// everything the parser keeps between statements
+// an address operand that names a label , kept for the relocation table of object files
+struct label_reference
+{
+	int pos; // offset of the low address byte
+	int label; // symbol id
+};
+
+struct assembly_state
+{
+	label_table LABEL_TABLE;
+	// symbol id => offsets of the address bytes waiting for the label , only while the label is not defined
+	std::unordered_map<int , std::vector<int>> fixups;
+	std::shared_ptr<symbol_arena> symbols; // names of the labels , those of the tokens parsed
+	binarySource TRANSLATED_SOURCE;
+	stream_writer *writer = nullptr; // set in streaming mode , bytes before TRANSLATED_SOURCE.base are on disk
+	bool relocatable = false; // assembling an object file , undefined labels are left to the linker
+	diagnostic_list *errors = nullptr; // errors are noted here and the parser goes on , nullptr stops at the first
+	std::vector<label_reference> references; // every label address emitted when relocatable or optimizing
+	bool optimize = false; // run the peephole optimizer once the labels are resolved
+	program_map *map = nullptr; // filled when set
+};
+
+void optimize_program(assembly_state &as);
+/*===========UTILITY STUFF FOR PRINTINTS AND STUFF*=========================*/
+
+void print_binary_source(binarySource &li)
+{
+	std::cout<<std::endl;
+	for(size_t i=0 ; i < li.bytes.size() ; i++)
+	{
+		std::cout<<i<<" : "<<std::bitset<BINARY_WORD_SIZE>(li.bytes[i])<<std::endl;
+	}
+}
+
+/*==========================================================================*/
+
+// gets the opcode from the opcode tables , the register , pair or restart operand is folded into the base opcode
+// operation is the index of the mnemonic token , op1 and op2 those of the operands or -1
+unsigned char getCode(const symbol_table &symt , int operation , OPERAND_SHAPE shape , int op1 , int op2)
+{
+	int line_no = symt.line_no[operation];
+	if(symt.tc[operation] != ID0 && symt.tc[operation] != ID1) // a label without its colon
+	{
+		fail(0 , line_no , "cant find opecode for " , symt.name(operation));
+	}
+	const mnemonic_def &d = MNEMONIC_LIST[symt.value[operation]];
+
+	// a single register operand can also be a register pair and a single data operand can be a restart number
+	bool match = d.shape == shape || (shape == OPS_REG && d.shape == OPS_PAIR) || (shape == OPS_DATA && d.shape == OPS_RST);
+	if(!match)
+	{
+		fail(0 , line_no , "the given operation " , d.name , " at line " , line_no , " does not take the given operands");
+	}
+
+	switch(d.field)
+	{
+		case F_DST :
+			return d.base | get_register_pos(symt.value[op1] , line_no)<<3;
+		case F_SRC :
+			return d.base | get_register_pos(symt.value[op1] , line_no);
+		case F_DST_SRC : {
+			int r1 = get_register_pos(symt.value[op1] , line_no);
+			int r2 = get_register_pos(symt.value[op2] , line_no);
+			if(r1 == 6 && r2 == 6)
+			{
+				fail(0 , line_no , "MOV M,M at line " , line_no , " is not part of architecture");
+			}
+			return d.base | r1<<3 | r2;
+		}
+		case F_PAIR_SP :
+		case F_PAIR_PSW :
+		case F_PAIR_BD :
+			return d.base | get_pair_pos(symt.value[op1] , d.field , line_no)<<4;
+		case F_RST : {
+			int n = symt.value[op1];
+			if(n < 0 || n > 7)
+			{
+				fail(0 , line_no , "restart number " , n , " at line " , line_no , " is not in 0-7");
+			}
+			return d.base | n<<3;
+		}
+		default :
+			return d.base;
+	}
+}
+
+// finds the label or adds it as not yet defined
+LABEL_TABLE_ENTRY &find_label(assembly_state &as , int label , int line_no)
+{
+	if(label >= (int)as.LABEL_TABLE.size())
+		as.LABEL_TABLE.resize(as.symbols->names.size());
+	LABEL_TABLE_ENTRY &entry = as.LABEL_TABLE[label];
+	if(entry.line_no == 0)
+		entry.line_no = line_no;
+	return entry;
+}
+
+// overwrites a byte emitted earlier , in streaming mode it may already be on disk
+void patch_byte(assembly_state &as , size_t pos , unsigned char byte)
+{
+	binarySource &TRANSLATED_SOURCE = as.TRANSLATED_SOURCE;
+	if(pos >= TRANSLATED_SOURCE.base)
+		TRANSLATED_SOURCE.bytes[pos - TRANSLATED_SOURCE.base] = byte;
+	else
+		stream_patch(as.writer , pos , byte);
+}
+
+void patch_label_fixups(assembly_state &as , int label , const LABEL_TABLE_ENTRY &entry)
+{
+	auto it = as.fixups.find(label);
+	if(it == as.fixups.end())
+		return;
+	unsigned short addr = as.TRANSLATED_SOURCE.origin + entry.mem_loc;
+	for(int fixup : it->second)
+	{
+		patch_byte(as , fixup , addr & 0xFF);
+		patch_byte(as , fixup+1 , addr >> BINARY_WORD_SIZE);
+	}
+	as.fixups.erase(it);
+}
+
+// pushes the two address bytes of the label , if the label is not defined yet the bytes are left zero and a fixup is recorded
+void emit_label_address(assembly_state &as , int label , int line_no)
+{
+	binarySource &TRANSLATED_SOURCE = as.TRANSLATED_SOURCE;
+	LABEL_TABLE_ENTRY &entry = find_label(as , label , line_no);
+	if(as.relocatable || as.optimize)
+		as.references.push_back({static_cast<int>(TRANSLATED_SOURCE.base + TRANSLATED_SOURCE.bytes.size()) , label});
+	if(entry.mem_loc >= 0)
+	{
+		unsigned short addr = TRANSLATED_SOURCE.origin + entry.mem_loc;
+		TRANSLATED_SOURCE.bytes.push_back(addr & 0xFF);
+		TRANSLATED_SOURCE.bytes.push_back(addr >> BINARY_WORD_SIZE);
+		return;
+	}
+	as.fixups[label].push_back(TRANSLATED_SOURCE.base + TRANSLATED_SOURCE.bytes.size());
+	TRANSLATED_SOURCE.bytes.push_back(0);
+	TRANSLATED_SOURCE.bytes.push_back(0);
+}
+
+// patches every recorded fixup once all labels are known
+void resolve_fixups(assembly_state &as)
+{
+	for(size_t label = 0 ; label < as.LABEL_TABLE.size() ; label++)
+	{
+		LABEL_TABLE_ENTRY &entry = as.LABEL_TABLE[label];
+		if(entry.line_no == 0 || (entry.mem_loc < 0 && as.relocatable)) // not a label or resolved by the linker
+			continue;
+		if(entry.mem_loc < 0)
+		{
+			assembly_error e = make_error(1 , entry.line_no , "unresolved label " , as.symbols->name(label) , " used at line " , entry.line_no);
+			if(as.errors == nullptr)
+				throw e;
+			as.errors->push_back(e);
+			continue;
+		}
+		patch_label_fixups(as , label , entry);
+	}
+}
+
+// pushes the two address bytes low byte first
+void emit_address(binarySource &TRANSLATED_SOURCE , int addr)
+{
+	TRANSLATED_SOURCE.bytes.push_back(addr & 0xFF);
+	TRANSLATED_SOURCE.bytes.push_back(addr >> BINARY_WORD_SIZE);
+}
+
+
+
+// runs the parser over whole statements , labels and bytes are kept in as so it can be called once per chunk
+void parse_statements(const symbol_table &symt , assembly_state &as)
+{
+	/*
+		LABEL: COLON ID0 | COLON ID1
+		ID0: ; | R,R; | R; 
+		ID1: ADDR; | R,D; | D; | LABEL; | R,ADDR; | R,LABEL;
+	*/
+
+	
+	binarySource &TRANSLATED_SOURCE = as.TRANSLATED_SOURCE;
+	const TOKEN_CLASS *tc = symt.tc.data();
+	as.symbols = symt.symbols;
+
+	int state=0;
+	int look_back=0;
+	int mem_loc=0;
+
+	for(int i = 0 ; i < (int)symt.size() ; i++)
+	try
+	{
+		mem_loc = TRANSLATED_SOURCE.base + TRANSLATED_SOURCE.bytes.size(); 
+		if(tc[i] == UKN) // the lexer noted it already , skip the statement
+		{
+			while(i < (int)symt.size() && tc[i] != EOL)
+				i++;
+			state = 0;
+			continue;
+		}
+		switch(state)
+		{
+			case 0 : {
+				if(tc[i] == ID0 || tc[i] == ID1) // ID0 => S1
+				{
+					if(as.map != nullptr)
+						as.map->lines.push_back({ mem_loc , symt.line_no[i] });
+					state=1;
+				}
+				else if(tc[i] == LABEL)
+				{
+					LABEL_TABLE_ENTRY &entry = find_label(as , symt.value[i] , symt.line_no[i]);
+					if(entry.mem_loc >= 0) // was this label already defined by rule LABEL: ID0|ID1
+					{
+						fail(1 , symt.line_no[i] , "reuse of label " , symt.name(i) , " for denoting jump position at line " , symt.line_no[i]); // if yes then stop since the label is getting used
 					}
+					entry.mem_loc = mem_loc;
+					if(STATS.enabled)
+						STATS.labels++;
+					// the JMP statements that came before are patched right away so as.fixups only holds undefined labels
+					patch_label_fixups(as , symt.value[i] , entry);
 					state=1;
 				}
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 
 			case 1 : {
-				if(symt[i].tc == EOL) // ID0 SEMICOLON
+				if(tc[i] == EOL) // ID0 SEMICOLON
 				{
 					look_back = i-1; // number_of_state passed
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(getCode(symt[look_back].value , symt[look_back].tc)).to_string());
+					TRANSLATED_SOURCE.bytes.push_back(getCode(symt , look_back , OPS_NONE , -1 , -1));
 					
 					state=0;
 				}
-				else if(symt[i].tc == REGISTER) // ID0 REGISTER => S2
+				else if(tc[i] == REGISTER) // ID0 REGISTER => S2
 					state=2;
-				else if(symt[i].tc == ADDR) // ID1 ADDR => S3
+				else if(tc[i] == ADDR) // ID1 ADDR => S3
 					state=3;
-				else if(symt[i].tc == DATA) // ID1 DATA => S6
+				else if(tc[i] == DATA) // ID1 DATA => S6
 					state=6;
-				else if(symt[i].tc == LABEL) // ID1 LABEL => S7
+				else if(tc[i] == LABEL) // ID1 LABEL => S7
 					state =7;
-				else if(symt[i].tc == COLON) // LABEL COLON => RESET
+				else if(tc[i] == COLON) // LABEL COLON => RESET
 					state = 0;
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 			case 2 : {
-				if(symt[i].tc == EOL) // ID0 REGISTER SEMICOLON => RESET
+				if(tc[i] == EOL) // ID0 REGISTER SEMICOLON => RESET
 				{
 					look_back = i-2; // number of state passed
-					unsigned char oppcode = (getCode(symt[look_back].value , symt[look_back].tc));
-					char reg = symt[look_back+1].value[0];
-					if(oppcode == ADD_MAP) // for ADD operation
-					 	oppcode = ADD_TABLE[get_register_pos(reg)];
-					else
-					{
-						std::cout<<std::endl<<"err: the given operation "<<symt[look_back].value<<"at line "<<symt[look_back].line_no<<" with one register operand is part of architecture but does not have a table for hex code"<<std::endl;
-						exit(0);
-					}
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					 // to be added more
+					unsigned char oppcode = getCode(symt , look_back , OPS_REG , look_back+1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
 					
 					state = 0;
 				}
-				else if(symt[i].tc == COMMA) // IDO REGISTER COMMA => S3
-					state = 3;
+				else if(tc[i] == COMMA) // IDO REGISTER COMMA => S8
+					state = 8;
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 
 				break;
 			}
 
 			case 3 :{
-				if(symt[i].tc == REGISTER) // ID0 REGISTER COMMA REGISTER => S4
-					state=4;
-				else if(symt[i].tc == EOL) // ID1 ADDR SEMICOLOR => RESET
+				if(tc[i] == EOL) // ID1 ADDR SEMICOLOR => RESET
 				{
 					look_back = i - 2; // two states back
-					unsigned char oppcode = (getCode(symt[look_back].value , symt[look_back].tc));
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					look_back++;
-					 // this is a problem i have no ide why it is there
-					// if we put statement ot t in directly in stoi then it gives out of bounds exception but why ?????
-					// OPEN BUG 
-					std::string lower_bit = symt[look_back].value.substr(2,2);
-					oppcode = std::stoi(lower_bit, nullptr , 16); // lower bit address arguements
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					oppcode = std::stoi(symt[look_back].value.substr(0,2), nullptr , 16);// higher bit address arguements
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
+					unsigned char oppcode = getCode(symt , look_back , OPS_ADDR , -1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					emit_address(TRANSLATED_SOURCE , symt.value[look_back+1]);
 					state=0;
 
 				}
-				else if(symt[i].tc == DATA) // ID1 REGISTER COMMA DATA => S5
-					state = 5;
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 
 			case 4 :{
-				if(symt[i].tc == EOL) // ID0 REGISTER COMMA REGISTER SEMICOLON => RESET
+				if(tc[i] == EOL) // ID0 REGISTER COMMA REGISTER SEMICOLON => RESET
 				{
 					look_back = i-4; // number of state passed
-					unsigned char oppcode = (getCode(symt[look_back].value , symt[look_back].tc));
-					char reg1 = symt[look_back+1].value[0];
-					char reg2 = symt[look_back+3].value[0]; // skipping the COMMA in between
-					if(oppcode == MOV_MAP) // for MOV opperation
-					{
-						oppcode = MOV_TABLE[get_register_pos(reg1)][get_register_pos(reg2)];
-					}
-					else
-					{
-						std::cout<<std::endl<<"err: the given operation "<<symt[look_back].value<<" at line "<<symt[look_back].line_no<<" with two register operands is not part of architecture or does not have its opcode table specified"<<std::endl;
-						exit(0);
-					}
-
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					 // to be added more
+					// skipping the COMMA in between
+					unsigned char oppcode = getCode(symt , look_back , OPS_REG_REG , look_back+1 , look_back+3);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
 					state = 0;
 					
 				}
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 
 			case 5 :{
-				if(symt[i].tc == EOL) // ID1 REGISTER COMMA DATA SEMICOLON => RESET
+				if(tc[i] == EOL) // ID1 REGISTER COMMA DATA SEMICOLON => RESET
 				{
 					look_back = i-4; // number of state passed
-					unsigned char oppcode = (getCode(symt[look_back].value , symt[look_back].tc));
-					char reg1 = symt[look_back+1].value[0];
-					if( oppcode == MVI_MAP)
-					{
-						oppcode = MVI_TABLE[get_register_pos(reg1)];
-
-					}
-					else
-					{
-						std::cout<<std::endl<<"err: the given operation "<<symt[look_back].value<<" at line "<<symt[look_back].line_no<<" with one register and data operand is not part of architecture or does not have its opcode table specified"<<std::endl;
-						exit(0);
-					}
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					oppcode = std::stoi(symt[look_back+3].value.substr(0,2), nullptr , 16);
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
+					unsigned char oppcode = getCode(symt , look_back , OPS_REG_DATA , look_back+1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					oppcode = symt.value[look_back+3];
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
 					
 					state=0;
 				}
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 
 			case 6 :{
-				if(symt[i].tc == EOL) // ID1 DATA SEMICOLON => RESET
+				if(tc[i] == EOL) // ID1 DATA SEMICOLON => RESET
 				{
 					look_back = i-2; // number of state passed
-					unsigned char oppcode = (getCode(symt[look_back].value , symt[look_back].tc));
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					oppcode = std::stoi(symt[look_back+1].value.substr(0,2), nullptr , 16);
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
+					unsigned char oppcode = getCode(symt , look_back , OPS_DATA , look_back+1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					if(MNEMONIC_LIST[symt.value[look_back]].shape == OPS_DATA) // RST has no data byte
+					{
+						oppcode = symt.value[look_back+1];
+						TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					}
 					
 					state=0;
 				}
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 
 			case 7 :{
-				if(symt[i].tc == EOL) // ID1 LABEL SEMICOLON => RESET
+				if(tc[i] == EOL) // ID1 LABEL SEMICOLON => RESET
 				{
 					look_back = i-2; // number of state passed
-					unsigned char oppcode = (getCode(symt[look_back].value , symt[look_back].tc));
-					TRANSLATED_SOURCE.push_back(std::bitset<BINARY_WORD_SIZE>(oppcode).to_string());
-					bool found=false;
-					// see whether the label exist in the list already or not
-					for(int k=0 ; k < LABEL_TABLE.size() ; k++)
-					{
-						if(LABEL_TABLE[k].resolve==false && LABEL_TABLE[k].LABEL_NAME == symt[look_back+1].value)
-						{
-							unsigned short sp= stoi(start_point , nullptr , 16); // converting 0x8000 to decimal integer
-							std::string addr = std::bitset<2*BINARY_WORD_SIZE>(sp + LABEL_TABLE[k].mem_loc).to_string();
-							TRANSLATED_SOURCE.push_back(addr.substr(BINARY_WORD_SIZE,BINARY_WORD_SIZE));
-							TRANSLATED_SOURCE.push_back(addr.substr(0,BINARY_WORD_SIZE));
-							found = true;
-							break;
-						}
-					}
-					if(!found)
-					{
-						TRANSLATED_SOURCE.push_back("");
-						TRANSLATED_SOURCE.push_back("");
-						LABEL_TABLE.push_back({symt[look_back+1].value , mem_loc , true});
-					}
+					unsigned char oppcode = getCode(symt , look_back , OPS_ADDR , -1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					emit_label_address(as , symt.value[look_back+1] , symt.line_no[look_back+1]);
 					state=0;
 				}
 				else
 				{
-					std::cout<<std::endl<<"err: cannot parse the line "<<symt[i].line_no<<std::endl;
-					exit(0);
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
 				}
 				break;
 			}
 
-		}
-	}
+			case 8 :{
+				if(tc[i] == REGISTER) // ID0 REGISTER COMMA REGISTER => S4
+					state=4;
+				else if(tc[i] == DATA) // ID1 REGISTER COMMA DATA => S5
+					state = 5;
+				else if(tc[i] == ADDR) // ID1 REGISTER COMMA ADDR => S9
+					state = 9;
+				else if(tc[i] == LABEL) // ID1 REGISTER COMMA LABEL => S10
+					state = 10;
+				else
+				{
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
+				}
+				break;
+			}
+
+			case 9 :{
+				if(tc[i] == EOL) // ID1 REGISTER COMMA ADDR SEMICOLON => RESET
+				{
+					look_back = i-4; // number of state passed
+					unsigned char oppcode = getCode(symt , look_back , OPS_PAIR_ADDR , look_back+1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					emit_address(TRANSLATED_SOURCE , symt.value[look_back+3]);
+					state=0;
+				}
+				else
+				{
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
+				}
+				break;
+			}
 
+			case 10 :{
+				if(tc[i] == EOL) // ID1 REGISTER COMMA LABEL SEMICOLON => RESET
+				{
+					look_back = i-4; // number of state passed
+					unsigned char oppcode = getCode(symt , look_back , OPS_PAIR_ADDR , look_back+1 , -1);
+					TRANSLATED_SOURCE.bytes.push_back(oppcode);
+					emit_label_address(as , symt.value[look_back+3] , symt.line_no[look_back+3]);
+					state=0;
+				}
+				else
+				{
+					fail(0 , symt.line_no[i] , "cannot parse the line " , symt.line_no[i]);
+				}
+				break;
+			}
 
-	for(int k=0 ; k < TRANSLATED_SOURCE.size() ; k++)
+		}
+	}
+	catch(const assembly_error &e)
 	{
-		if(TRANSLATED_SOURCE[k] == "")
-		{
-			std::cout<<"err: possible unresolved labels";
-			exit(1);
-		}		
+		if(as.errors == nullptr)
+			throw;
+		as.errors->push_back(e);
+		while(i < (int)symt.size() && tc[i] != EOL) // panic mode , start again after the next EOL
+			i++;
+		state = 0;
 	}
+}
 
-	return TRANSLATED_SOURCE;
+binarySource parse_symbol_table(const symbol_table &symt , const std::string &start_point , diagnostic_list *errors = nullptr , bool optimize = false ,
+	program_map *map = nullptr)
+{
+	assembly_state as;
+	as.errors = errors;
+	as.optimize = optimize;
+	as.map = map;
+	as.TRANSLATED_SOURCE.origin = stoi(start_point , nullptr , 16); // converting 0x8000 to decimal integer
+	as.TRANSLATED_SOURCE.bytes.reserve(symt.size());
+	parse_statements(symt , as);
+	resolve_fixups(as);
+	check_diagnostics(errors);
+	if(optimize)
+		optimize_program(as);
+	for(size_t label = 0 ; label < as.LABEL_TABLE.size() ; label++)
+	{
+		LABEL_TABLE_ENTRY &entry = as.LABEL_TABLE[label];
+		if(entry.mem_loc < 0)
+			continue;
+		as.TRANSLATED_SOURCE.labels.push_back(as.TRANSLATED_SOURCE.origin + entry.mem_loc);
+		if(map != nullptr)
+			map->labels.push_back({ entry.mem_loc , std::string(as.symbols->name(label)) });
+	}
+	if(map != nullptr)
+		std::sort(map->labels.begin() , map->labels.end());
+	return std::move(as.TRANSLATED_SOURCE);
 }
 
 /////////////////////////////////////////////////////// parser ends ////////////////////////////////////////////////////
 
-////////////////////////////////////////////////////// WRITE FILE   //////////////////////////////////////////////////////
+/*===============================PEEPHOLE OPTIMIZER==================================*/
+/*
+	-O rewrites the assembled program before it is written. the bytes are decoded back into instructions and an
+	address operand that names a label points at the instruction of the label. then , until nothing changes :
+		a jump or call to a JMP goes straight to where that JMP goes
+		JMP/Jcc to a RET becomes RET/Rcc when that costs no more T-states taken or not taken
+		JMP/Jcc to the next instruction and MOV r,r are dropped , so is code after JMP , RET or PCHL no label points at
+	the instructions left are laid out again and the labels and their uses move with them.
+	a numeric address into the program (STA 8002H) may read or write code in place , nothing up to it is changed.
+*/
+struct peephole_insn
+{
+	int pos; // offset before the pass
+	int length;
+	unsigned char op;
+	int target = -1; // instruction a label operand points at , -1 for other operands
+	bool labeled = false; // a label is defined here
+	bool frozen = false; // at or before a numeric address into the program
+	bool dead = false;
+};
+
+bool is_jump_opcode(unsigned char op) { return op == 0xC3 || (op & 0xC7) == 0xC2; }
+bool is_call_opcode(unsigned char op) { return op == 0xCD || (op & 0xC7) == 0xC4; }
+bool ends_flow(unsigned char op) { return op == 0xC3 || op == 0xC9 || op == 0xE9; } // JMP RET PCHL
 
-void writeFile(binarySource bs, std::string filename)
+// first instruction from i on that is kept , insns.size() past the end
+int live_from(const std::vector<peephole_insn> &insns , int i)
 {
-	std::ofstream output(filename);
-	if (output)
+	while(i < (int)insns.size() && insns[i].dead)
+		i++;
+	return i;
+}
+
+void optimize_program(assembly_state &as)
+{
+	binarySource &bs = as.TRANSLATED_SOURCE;
+	const int size = bs.bytes.size();
+	std::vector<peephole_insn> insns;
+	std::vector<int> index_at(size + 1 , -1); // offset => instruction starting there
+	for(int pos = 0 ; pos < size ; )
 	{
-		for(int i = 0 ; i < bs.size() ; i++)
+		unsigned char op = bs.bytes[pos];
+		int length = OPCODE_TABLE[op].mnemonic == NO_MNEMONIC ? 1 : OPCODE_TABLE[op].length;
+		if(pos + length > size)
+			return; // not code the parser made , leave it alone
+		index_at[pos] = insns.size();
+		insns.push_back({ pos , length , op });
+		pos += length;
+	}
+	const int n = insns.size();
+	index_at[size] = n;
+
+	for(auto &entry : as.LABEL_TABLE)
+		if(entry.mem_loc >= 0)
 		{
-			output<<bs[i]<<"\n";
+			if(index_at[entry.mem_loc] < 0)
+				return;
+			if(entry.mem_loc < size)
+				insns[index_at[entry.mem_loc]].labeled = true;
 		}
-		output.close();
+	std::vector<unsigned char> named(n); // the operand is a label
+	for(auto &ref : as.references)
+	{
+		int i = index_at[ref.pos - 1];
+		int target = index_at[as.LABEL_TABLE[ref.label].mem_loc];
+		if(i < 0 || target < 0)
+			return;
+		insns[i].target = target;
+		named[i] = 1;
 	}
-	else
-		std::cout<<"err: failed to create file "<<std::endl;
-	exit(1);
-}
+	int fixed_end = 0; // bytes before it keep their place
+	for(auto &in : insns)
+	{
+		int addr = in.length == 3 ? (bs.bytes[in.pos+1] | bs.bytes[in.pos+2] << 8) - bs.origin : -1;
+		if(!named[&in - &insns[0]] && addr >= 0 && addr < size)
+			fixed_end = std::max(fixed_end , addr + 1);
+	}
+	for(auto &in : insns)
+		in.frozen = in.pos < fixed_end;
 
+	int removed = 0 , rewritten = 0;
+	long t_states = 0; // saved once through every changed instruction , taken cost for jumps
+	for(bool changed = true ; changed ; )
+	{
+		changed = false;
+		for(int i = 0 ; i < n ; i++)
+		{
+			peephole_insn &in = insns[i];
+			if(in.dead || in.frozen)
+				continue;
+			unsigned char op = in.op;
+			if((op & 0xC0) == 0x40 && op != 0x76 && ((op >> 3) & 7) == (op & 7)) // MOV r,r
+			{
+				in.dead = true;
+				removed++;
+				t_states += OPCODE_TABLE[op].t_min;
+				changed = true;
+				continue;
+			}
+			if(in.target < 0 || !(is_jump_opcode(op) || is_call_opcode(op)))
+				continue;
 
+			int t = live_from(insns , in.target) , hops = 0;
+			for( ; t < n && insns[t].op == 0xC3 && insns[t].target >= 0 && hops < n ; hops++) // JMP to JMP
+			{
+				int next = live_from(insns , insns[t].target);
+				if(next == t)
+					break;
+				t = next;
+			}
+			if(hops == n) // the jumps go round in a loop
+				continue;
+			if(hops > 0)
+			{
+				rewritten++;
+				t_states += hops * OPCODE_TABLE[0xC3].t_max;
+				changed = true;
+			}
+			in.target = t;
+			if(!is_jump_opcode(op))
+				continue;
+			if(t == live_from(insns , i + 1)) // jump to the next instruction
+			{
+				in.dead = true;
+				removed++;
+				t_states += OPCODE_TABLE[op].t_max;
+				changed = true;
+			}
+			else if(t < n && insns[t].op == 0xC9) // jump to RET
+			{
+				unsigned char ret = op == 0xC3 ? 0xC9 : op - 2; // Jcc 11ccc010 => Rcc 11ccc000
+				const opcode_def &j = OPCODE_TABLE[op] , &r = OPCODE_TABLE[ret];
+				int taken = j.t_max + OPCODE_TABLE[0xC9].t_min;
+				if(r.t_max <= taken && r.t_min <= j.t_min)
+				{
+					in.op = ret;
+					in.length = 1;
+					in.target = -1;
+					rewritten++;
+					t_states += taken - r.t_max;
+					changed = true;
+				}
+			}
+		}
+		for(int i = 0 ; i < n ; i++) // unreachable code
+		{
+			if(insns[i].dead || !ends_flow(insns[i].op))
+				continue;
+			for(int k = i + 1 ; k < n && !insns[k].labeled && !insns[k].frozen ; k++)
+				if(!insns[k].dead)
+				{
+					insns[k].dead = true;
+					removed++;
+					changed = true;
+				}
+		}
+	}
+	if(removed == 0 && rewritten == 0)
+		return;
 
+	std::vector<int> new_pos(n + 1); // a dropped instruction takes the place of the next one kept
+	int pos = 0;
+	for(int i = 0 ; i < n ; i++)
+	{
+		new_pos[i] = pos;
+		if(!insns[i].dead)
+			pos += insns[i].length;
+	}
+	new_pos[n] = pos;
 
-int main(int argc  , char *argv[])
-{
-	if(argc < 2)
-		std::cout<<"err: No file given"<<std::endl;
-	else
+	std::vector<unsigned char> bytes;
+	bytes.reserve(pos);
+	for(auto &in : insns)
+	{
+		if(in.dead)
+			continue;
+		bytes.push_back(in.op);
+		if(in.target >= 0)
 		{
-			std::string start_point="8000";
-			if(argc == 3)
-			{
-				start_point = argv[2];
-			}	
-			auto b = readfile(argv[1]);
-			auto st = lex_analyse_source(b);
-			auto ts = parse_symbol_table(st , start_point);
-			writeFile(ts , "a.dat");
+			unsigned short addr = bs.origin + new_pos[in.target];
+			bytes.push_back(addr & 0xFF);
+			bytes.push_back(addr >> BINARY_WORD_SIZE);
 		}
-}
\ No newline at end of file
+		else
+			bytes.insert(bytes.end() , bs.bytes.begin() + in.pos + 1 , bs.bytes.begin() + in.pos + in.length);
+	}
+	for(auto &entry : as.LABEL_TABLE)
+		if(entry.mem_loc >= 0)
+			entry.mem_loc = new_pos[index_at[entry.mem_loc]];
+	if(as.map != nullptr) // dropped statements leave the map
+	{
+		std::vector<std::pair<int , int>> lines;
+		for(auto &line : as.map->lines)
+			if(!insns[index_at[line.first]].dead)
+				lines.push_back({ new_pos[index_at[line.first]] , line.second });
+		as.map->lines = std::move(lines);
+	}
+	if(STATS.enabled)
+		std::cerr<<"peephole : "<<removed<<" instructions removed , "<<rewritten<<" rewritten , "<<size - pos<<" bytes and "
+			<<t_states<<" T-states saved"<<std::endl;
+	bs.bytes = std::move(bytes);
+	as.references.clear(); // threaded jumps no longer go to the label they name
+}
+
+////////////////////////////////////////////////////// WRITE FILE   //////////////////////////////////////////////////////
+
+enum OUTPUT_FORMAT { OUT_DAT , OUT_BIN , OUT_HEX };
+
+// one line of '0'/'1' characters per byte , the original a.dat format
+std::string format_binary_text(const binarySource &bs)
+{
+	std::string out(bs.bytes.size() * (BINARY_WORD_SIZE+1) , '\n');
+	char *p = &out[0];
+	for(unsigned char byte : bs.bytes)
+	{
+		for(int bit = BINARY_WORD_SIZE-1 ; bit >= 0 ; bit--)
+			*p++ = (byte >> bit) & 1 ? '1' : '0';
+		p++; // keep the newline
+	}
+	return out;
+}
+
+// appends the byte as two hex digits and adds it to the record checksum
+void put_hex_byte(std::string &out , unsigned char b , unsigned char &sum)
+{
+	static const char HEX[] = "0123456789ABCDEF";
+	out += HEX[b >> 4];
+	out += HEX[b & 0xF];
+	sum += b;
+}
+
+// intel hex records of 16 data bytes followed by the end of file record
+std::string format_intel_hex(const binarySource &bs , bool eof_record = true)
+{
+	std::string out;
+	out.reserve(bs.bytes.size() * 2 + (bs.bytes.size() / 16 + 2) * 12);
+
+	for(size_t i = 0 ; i < bs.bytes.size() ; i += 16)
+	{
+		unsigned char count = std::min<size_t>(16 , bs.bytes.size() - i);
+		unsigned short addr = bs.origin + bs.base + i;
+		unsigned char sum = 0;
+		out += ':';
+		put_hex_byte(out , count , sum);
+		put_hex_byte(out , addr >> 8 , sum);
+		put_hex_byte(out , addr & 0xFF , sum);
+		put_hex_byte(out , 0x00 , sum); // data record
+		for(size_t k = i ; k < i + count ; k++)
+			put_hex_byte(out , bs.bytes[k] , sum);
+		unsigned char ignore = 0;
+		put_hex_byte(out , -sum & 0xFF , ignore);
+		out += '\n';
+	}
+	if(eof_record)
+		out += ":00000001FF\n";
+	return out;
+}
+
+// every format is built in memory and flushed with a single write
+bool write_output(const binarySource &bs, std::string filename , OUTPUT_FORMAT format)
+{
+	std::ofstream output(filename , std::ios::binary);
+	if (!output)
+		return false;
+	if(format == OUT_BIN)
+		output.write(reinterpret_cast<const char *>(bs.bytes.data()) , bs.bytes.size());
+	else
+	{
+		std::string text = format == OUT_HEX ? format_intel_hex(bs) : format_binary_text(bs);
+		output.write(text.data() , text.size());
+	}
+	STATS.output_bytes += output.tellp();
+	output.close();
+	return true;
+}
+
+void writeFile(const binarySource &bs, std::string filename , OUTPUT_FORMAT format)
+{
+	if (!write_output(bs , filename , format))
+		fail(1 , 0 , "failed to create file ");
+}
+
+
+/*=================================STREAMING MODE====================================*/
+// the source is read in chunks of STREAM_CHUNK_SIZE , each chunk is cut at the last ';' and the rest carried over
+#define STREAM_CHUNK_SIZE (1<<20)
+#define HEX_RECORD_BYTES 16
+#define HEX_RECORD_LENGTH 44 // ":10AAAA00" + 32 digits + checksum + newline
+
+struct stream_writer
+{
+	int fd;
+	OUTPUT_FORMAT format;
+};
+
+// writes out the bytes of bs , all but the last partial hex record unless last is set
+void stream_flush(stream_writer *writer , binarySource &bs , bool last)
+{
+	size_t n = last ? bs.bytes.size() : bs.bytes.size() - bs.bytes.size() % HEX_RECORD_BYTES;
+	if(n == 0)
+		return;
+	binarySource out;
+	out.origin = bs.origin;
+	out.base = bs.base;
+	out.bytes.assign(bs.bytes.begin() , bs.bytes.begin() + n);
+
+	std::string text;
+	const char *data = reinterpret_cast<const char *>(out.bytes.data());
+	if(writer->format != OUT_BIN)
+	{
+		text = writer->format == OUT_HEX ? format_intel_hex(out , false) : format_binary_text(out);
+		data = text.data();
+	}
+	size_t size = writer->format == OUT_BIN ? n : text.size();
+	STATS.output_bytes += size;
+	if(write(writer->fd , data , size) != (ssize_t)size)
+	{
+		fail(1 , 0 , "failed to write output");
+	}
+	bs.bytes.erase(bs.bytes.begin() , bs.bytes.begin() + n);
+	bs.base += n;
+}
+
+// pwrite of all size bytes or fail
+void stream_pwrite(stream_writer *writer , const void *data , size_t size , off_t offset)
+{
+	if(pwrite(writer->fd , data , size , offset) != (ssize_t)size)
+	{
+		fail(1 , 0 , "failed to patch output");
+	}
+}
+
+// overwrites a byte that is already written to the output file
+void stream_patch(stream_writer *writer , size_t pos , unsigned char byte)
+{
+	if(writer->format == OUT_BIN)
+	{
+		stream_pwrite(writer , &byte , 1 , pos);
+	}
+	else if(writer->format == OUT_DAT)
+	{
+		char bits[BINARY_WORD_SIZE];
+		for(int bit = 0 ; bit < BINARY_WORD_SIZE ; bit++)
+			bits[bit] = (byte >> (BINARY_WORD_SIZE-1-bit)) & 1 ? '1' : '0';
+		stream_pwrite(writer , bits , BINARY_WORD_SIZE , pos * (BINARY_WORD_SIZE+1));
+	}
+	else // the record holding the byte is read back , patched and its checksum recomputed
+	{
+		char record[HEX_RECORD_LENGTH];
+		off_t offset = (pos / HEX_RECORD_BYTES) * HEX_RECORD_LENGTH;
+		if(pread(writer->fd , record , HEX_RECORD_LENGTH , offset) != HEX_RECORD_LENGTH || record[0] != ':')
+		{
+			fail(1 , 0 , "failed to read back output record at " , offset);
+		}
+		std::string line = ":";
+		unsigned char sum = 0;
+		for(int k = 0 ; k < 4 + HEX_RECORD_BYTES ; k++)
+		{
+			unsigned char b = 0;
+			if(std::from_chars(record + 1 + 2*k , record + 3 + 2*k , b , 16).ptr != record + 3 + 2*k)
+			{
+				fail(1 , 0 , "bad output record at " , offset);
+			}
+			if(k == 4 + (int)(pos % HEX_RECORD_BYTES))
+				b = byte;
+			put_hex_byte(line , b , sum);
+		}
+		unsigned char ignore = 0;
+		put_hex_byte(line , -sum & 0xFF , ignore);
+		stream_pwrite(writer , line.data() , line.size() , offset);
+	}
+}
+
+/*
+	lexer , parser and writer run as a pipeline over fixed size chunks of the source.
+	the tokens of a chunk are views into the chunk buffer and the parsed bytes are flushed after every chunk ,
+	so memory is bounded by the chunk size , the labels and the forward references that are still unresolved.
+	a defined label keeps its name and 8 bytes of LABEL_TABLE for the rest of the run since any later statement may
+	jump back to it , only the fixup lists of undefined labels are dropped once they are patched.
+*/
+void stream_assemble(char *filename , std::string start_point , std::string output_file , OUTPUT_FORMAT format)
+{
+	int in = open(filename , O_RDONLY);
+	if(in < 0)
+	{
+		fail(1 , 0 , "No such file exist");
+	}
+	stream_writer writer = { open(output_file.c_str() , O_RDWR | O_CREAT | O_TRUNC , 0644) , format };
+	if(writer.fd < 0)
+	{
+		fail(1 , 0 , "failed to create file ");
+	}
+
+	assembly_state as;
+	as.writer = &writer;
+	as.TRANSLATED_SOURCE.origin = stoi(start_point , nullptr , 16); // converting 0x8000 to decimal integer
+
+	std::vector<char> chunk(STREAM_CHUNK_SIZE);
+	symbol_table tokens;
+	size_t carry = 0; // bytes of an unfinished statement moved to the front of the chunk
+	int line_no = 1;
+	bool eof = false;
+	while(!eof)
+	{
+		ssize_t n = read(in , chunk.data() + carry , chunk.size() - carry);
+		if(n < 0)
+		{
+			fail(1 , 0 , "failed to read " , filename);
+		}
+		eof = n == 0;
+		size_t len = carry + n;
+		size_t end = len;
+		if(!eof)
+		{
+			while(end > 0 && chunk[end-1] != EOL)
+				end--;
+			if(end == 0)
+			{
+				fail(1 , line_no , "statement at line " , line_no , " is longer than the stream chunk");
+			}
+		}
+
+		tokens.clear();
+		lex_analyse_chunk(std::string_view(chunk.data() , end) , tokens , line_no);
+		if(has_directives(tokens))
+			fail(1 , line_no , "INCLUDE , EQU and MACRO cannot be used with --stream");
+		parse_statements(tokens , as);
+		stream_flush(&writer , as.TRANSLATED_SOURCE , false);
+
+		carry = len - end;
+		std::copy(chunk.begin() + end , chunk.begin() + len , chunk.begin());
+	}
+	close(in);
+
+	resolve_fixups(as);
+	stream_flush(&writer , as.TRANSLATED_SOURCE , true);
+	if(format == OUT_HEX)
+		write(writer.fd , ":00000001FF\n" , 12);
+	close(writer.fd);
+}
+
+
+/*=============================OBJECT FILES AND LINKER===============================*/
+/*
+	an object file holds the code of one source assembled at address 0 , its labels and a relocation for every
+	address operand that names a label. all labels are visible to other objects , a reference is resolved to the
+	label of its own object first and only undefined labels are looked up in the other objects.
+========================================================================
+	.o85 layout (little endian)
+	"O85" 1 | u32 code size | code | u32 symbol count | { u8 defined , u16 offset , u8 name length , name }
+	| u32 relocation count | { u32 pos , u32 symbol }
+*/
+#define OBJECT_MAGIC "O85\1"
+
+struct object_symbol
+{
+	std::string name;
+	bool defined;
+	unsigned short offset; // offset in the code when defined
+};
+
+struct relocation
+{
+	unsigned int pos; // offset of the low address byte in the code
+	unsigned int symbol; // index in symbols
+};
+
+struct object_file
+{
+	std::string name;
+	std::vector<unsigned char> code;
+	std::vector<object_symbol> symbols;
+	std::vector<relocation> relocations;
+};
+
+// assembles the source at address 0 keeping what the linker needs to place it anywhere
+object_file assemble_object(char *filename , include_cache &includes)
+{
+	auto b = readfile(filename);
+	diagnostic_list errors;
+	auto st = lex_analyse_source(b.view() , &errors);
+	if(has_directives(st))
+	{
+		check_diagnostics(&errors);
+		st = preprocess_source(st , includes , directory_of(filename));
+	}
+	assembly_state as;
+	as.relocatable = true;
+	as.errors = &errors;
+	parse_statements(st , as);
+	resolve_fixups(as);
+	check_diagnostics(&errors);
+
+	object_file obj;
+	obj.name = filename;
+	obj.code = std::move(as.TRANSLATED_SOURCE.bytes);
+	std::vector<unsigned int> index(as.LABEL_TABLE.size()); // symbol id => index in obj.symbols
+	for(size_t label = 0 ; label < as.LABEL_TABLE.size() ; label++)
+	{
+		LABEL_TABLE_ENTRY &entry = as.LABEL_TABLE[label];
+		if(entry.line_no == 0)
+			continue;
+		index[label] = obj.symbols.size();
+		obj.symbols.push_back({std::string(as.symbols->name(label)) , entry.mem_loc >= 0 , static_cast<unsigned short>(std::max(entry.mem_loc , 0))});
+	}
+	for(auto &ref : as.references)
+		obj.relocations.push_back({static_cast<unsigned int>(ref.pos) , index[ref.label]});
+	return obj;
+}
+
+void put_u16(std::string &out , unsigned int v)
+{
+	out += static_cast<char>(v & 0xFF);
+	out += static_cast<char>((v >> 8) & 0xFF);
+}
+
+void put_u32(std::string &out , unsigned int v)
+{
+	put_u16(out , v & 0xFFFF);
+	put_u16(out , v >> 16);
+}
+
+void write_object(const object_file &obj , std::string filename)
+{
+	std::string out = OBJECT_MAGIC;
+	put_u32(out , obj.code.size());
+	out.append(obj.code.begin() , obj.code.end());
+	put_u32(out , obj.symbols.size());
+	for(auto &sym : obj.symbols)
+	{
+		out += static_cast<char>(sym.defined);
+		put_u16(out , sym.offset);
+		out += static_cast<char>(sym.name.size());
+		out += sym.name;
+	}
+	put_u32(out , obj.relocations.size());
+	for(auto &rel : obj.relocations)
+	{
+		put_u32(out , rel.pos);
+		put_u32(out , rel.symbol);
+	}
+
+	std::ofstream output(filename , std::ios::binary);
+	if(!output.write(out.data() , out.size()))
+	{
+		fail(1 , 0 , "failed to create file " , filename);
+	}
+}
+
+// reads little endian values out of a mapped object file , running past the end is an error
+struct object_reader
+{
+	std::string_view data;
+	size_t pos;
+	char *filename;
+
+	const char *take(size_t n)
+	{
+		if(pos + n > data.size())
+		{
+			fail(1 , 0 , "object file " , filename , " is truncated");
+		}
+		pos += n;
+		return data.data() + pos - n;
+	}
+	unsigned int u8() { return static_cast<unsigned char>(*take(1)); }
+	unsigned int u16() { unsigned int lo = u8(); return lo | u8() << 8; }
+	unsigned int u32() { unsigned int lo = u16(); return lo | u16() << 16; }
+};
+
+object_file read_object(char *filename)
+{
+	auto b = readfile(filename);
+	object_reader r = { b.view() , 0 , filename };
+	if(std::string_view(r.take(4) , 4) != OBJECT_MAGIC)
+	{
+		fail(1 , 0 , filename , " is not an object file");
+	}
+	object_file obj;
+	obj.name = filename;
+	unsigned int size = r.u32();
+	const char *code = r.take(size);
+	obj.code.assign(code , code + size);
+	obj.symbols.resize(r.u32());
+	for(auto &sym : obj.symbols)
+	{
+		sym.defined = r.u8();
+		sym.offset = r.u16();
+		unsigned int len = r.u8();
+		sym.name.assign(r.take(len) , len);
+	}
+	obj.relocations.resize(r.u32());
+	for(auto &rel : obj.relocations)
+	{
+		rel.pos = r.u32();
+		rel.symbol = r.u32();
+		if(rel.symbol >= obj.symbols.size() || rel.pos + 1 >= obj.code.size())
+		{
+			fail(1 , 0 , "bad relocation in object file " , filename);
+		}
+	}
+	return obj;
+}
+
+// places the objects one after the other from the start point and applies their relocations
+binarySource link_objects(const std::vector<object_file> &objects , std::string start_point)
+{
+	binarySource linked;
+	linked.origin = stoi(start_point , nullptr , 16); // converting 0x8000 to decimal integer
+
+	std::vector<unsigned int> base(objects.size());
+	std::unordered_map<std::string_view , std::pair<int , unsigned int>> owner; // label => object defining it (-1 when defined twice) , address
+	for(size_t k = 0 ; k < objects.size() ; k++)
+	{
+		base[k] = linked.bytes.size();
+		linked.bytes.insert(linked.bytes.end() , objects[k].code.begin() , objects[k].code.end());
+		for(auto &sym : objects[k].symbols)
+		{
+			if(!sym.defined)
+				continue;
+			linked.labels.push_back(linked.origin + base[k] + sym.offset);
+			auto it = owner.try_emplace(sym.name , k , base[k] + sym.offset).first;
+			if(it->second.first != (int)k)
+				it->second.first = -1;
+		}
+	}
+	if(linked.bytes.size() > 0x10000)
+	{
+		fail(1 , 0 , "linked program is larger than 64K");
+	}
+
+	for(size_t k = 0 ; k < objects.size() ; k++)
+	{
+		for(auto &rel : objects[k].relocations)
+		{
+			const object_symbol &sym = objects[k].symbols[rel.symbol];
+			unsigned int addr;
+			if(sym.defined)
+				addr = base[k] + sym.offset;
+			else
+			{
+				auto it = owner.find(sym.name);
+				if(it == owner.end())
+				{
+					fail(1 , 0 , "unresolved label " , sym.name , " used in " , objects[k].name);
+				}
+				if(it->second.first < 0)
+				{
+					fail(1 , 0 , "label " , sym.name , " used in " , objects[k].name , " is defined in more than one object");
+				}
+				addr = it->second.second;
+			}
+			addr += linked.origin;
+			linked.bytes[base[k] + rel.pos] = addr & 0xFF;
+			linked.bytes[base[k] + rel.pos + 1] = (addr >> BINARY_WORD_SIZE) & 0xFF;
+		}
+	}
+	return linked;
+}
+
+// runs job(0) ... job(n-1) on a pool of worker threads , the first error of a job is raised again after the join
+void parallel_for(int n , int threads , const std::function<void(int)> &job)
+{
+	std::atomic<int> next(0);
+	std::vector<std::thread> pool;
+	std::exception_ptr error;
+	std::mutex error_lock;
+	for(int t = 0 ; t < std::min(threads , n) ; t++)
+		pool.emplace_back([&]() {
+			try
+			{
+				for(int i = next++ ; i < n ; i = next++)
+					job(i);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(error_lock);
+				if(!error)
+					error = std::current_exception();
+				next = n;
+			}
+		});
+	for(auto &worker : pool)
+		worker.join();
+	if(error)
+		std::rethrow_exception(error);
+}
+
+bool is_object_file(std::string filename)
+{
+	return filename.size() > 4 && filename.compare(filename.size()-4 , 4 , ".o85") == 0;
+}
+
+// a.asm => a.o85
+std::string object_file_name(std::string filename)
+{
+	size_t dot = filename.find_last_of('.');
+	if(dot == std::string::npos || filename.find('/' , dot) != std::string::npos)
+		return filename + ".o85";
+	return filename.substr(0 , dot) + ".o85";
+}
+
+// assembles the sources concurrently and loads the object files given
+std::vector<object_file> load_objects(const std::vector<char *> &inputs , int threads , include_cache &includes)
+{
+	std::vector<object_file> objects(inputs.size());
+	parallel_for(inputs.size() , threads , [&](int i) {
+		objects[i] = is_object_file(inputs[i]) ? read_object(inputs[i]) : assemble_object(inputs[i] , includes);
+	});
+	return objects;
+}
+
+// a start point is 1 to 4 hex digits
+bool is_start_point(std::string arg)
+{
+	if(arg.empty() || arg.size() > 4)
+		return false;
+	for(char c : arg)
+		if(!isxdigit(c))
+			return false;
+	return true;
+}
+
+
+/*================================ASSEMBLY CACHE=====================================*/
+/*
+	--cache dir keeps the assembled program of every source in dir , keyed by a hash of the source bytes , the start
+	point and the assembler version , so a source seen before is not lexed or parsed again. entries are written to a
+	temporary file and renamed into place so concurrent runs can share the directory. a hit touches the entry and
+	after a store the least recently used entries are removed until the directory fits in --cache-size MB.
+	the version is -DASSEMBLER_BUILD when the build passes one (a hash of main.cc and the headers) , else a hash of
+	the executable itself : identical builds of the same sources share entries and any change to the code starts a
+	cold cache. --cache is skipped when neither is known.
+========================================================================
+	entry layout (little endian) "A85C" | u16 origin | u32 size | bytes | u32 label count | { u16 address }
+*/
+#define ASSEMBLER_NAME "8085-asm"
+#define CACHE_MAGIC "A85C"
+#define CACHE_SUFFIX ".a85c"
+#define DEFAULT_CACHE_MB 256
+
+unsigned long long rotl64(unsigned long long x , int r)
+{
+	return x << r | x >> (64 - r);
+}
+
+unsigned long long mix64(unsigned long long h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	return h ^ h >> 33;
+}
+
+// 64 bit hash taking 8 bytes per round
+unsigned long long hash_bytes(std::string_view data , unsigned long long seed)
+{
+	const unsigned long long C1 = 0x87C37B91114253D5ULL , C2 = 0x4CF5AD432745937FULL;
+	unsigned long long h = seed ^ data.size();
+	size_t i = 0;
+	for( ; i + 8 <= data.size() ; i += 8)
+	{
+		unsigned long long w;
+		memcpy(&w , data.data() + i , 8);
+		h ^= rotl64(w * C1 , 31) * C2;
+		h = rotl64(h , 27) * 5 + 0x52DCE729;
+	}
+	unsigned long long w = 0;
+	memcpy(&w , data.data() + i , data.size() - i);
+	h ^= rotl64(w * C1 , 31) * C2;
+	return mix64(h);
+}
+
+// the build of the assembler the entries belong to , worked out once , empty when it cannot be told
+const std::string &assembler_version()
+{
+	static const std::string version = []
+	{
+#ifdef ASSEMBLER_BUILD
+		return std::string(ASSEMBLER_NAME " ") + ASSEMBLER_BUILD;
+#else
+		try
+		{
+			auto b = readfile("/proc/self/exe");
+			char hash[20];
+			snprintf(hash , sizeof(hash) , "%016llx" , hash_bytes(b.view() , 0));
+			return std::string(ASSEMBLER_NAME " ") + hash;
+		}
+		catch(const assembly_error &) // without /proc
+		{
+			return std::string();
+		}
+#endif
+	}();
+	return version;
+}
+
+// two hashes with different seeds make the 128 bit key
+std::string cache_key(std::string_view source , std::string start_point)
+{
+	std::string setting = start_point + '\0' + assembler_version();
+	char key[40];
+	snprintf(key , sizeof(key) , "%016llx%016llx" ,
+		hash_bytes(source , hash_bytes(setting , 1)) , hash_bytes(source , hash_bytes(setting , 2)));
+	return key;
+}
+
+// a missing or damaged entry is a miss
+bool cache_load(std::string dir , std::string key , binarySource &bs)
+{
+	std::string path = dir + "/" + key + CACHE_SUFFIX;
+	if(access(path.c_str() , R_OK) != 0)
+		return false;
+	try
+	{
+		auto b = readfile(path.c_str());
+		object_reader r = { b.view() , 0 , const_cast<char *>(path.c_str()) };
+		if(std::string_view(r.take(4) , 4) != CACHE_MAGIC)
+			return false;
+		bs.origin = r.u16();
+		unsigned int size = r.u32();
+		const char *bytes = r.take(size);
+		bs.bytes.assign(bytes , bytes + size);
+		bs.labels.resize(r.u32());
+		for(auto &label : bs.labels)
+			label = r.u16();
+	}
+	catch(const assembly_error &)
+	{
+		return false;
+	}
+	utimensat(AT_FDCWD , path.c_str() , nullptr , 0); // most recently used
+	return true;
+}
+
+struct cache_entry
+{
+	struct timespec used;
+	std::string path;
+	off_t size;
+};
+
+// removes the least recently used entries until the directory holds at most limit bytes
+void cache_evict(std::string dir , unsigned long long limit)
+{
+	DIR *d = opendir(dir.c_str());
+	if(d == nullptr)
+		return;
+	std::vector<cache_entry> entries;
+	unsigned long long total = 0;
+	while(dirent *e = readdir(d))
+	{
+		std::string name = e->d_name;
+		if(name.size() <= strlen(CACHE_SUFFIX) || name.compare(name.size() - strlen(CACHE_SUFFIX) , std::string::npos , CACHE_SUFFIX) != 0)
+			continue;
+		struct stat st;
+		std::string path = dir + "/" + name;
+		if(stat(path.c_str() , &st) != 0)
+			continue;
+		total += st.st_size;
+		entries.push_back({ st.st_mtim , path , st.st_size });
+	}
+	closedir(d);
+	if(total <= limit)
+		return;
+	std::sort(entries.begin() , entries.end() , [](const cache_entry &a , const cache_entry &b) {
+		return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+	});
+	for(auto &entry : entries)
+	{
+		if(total <= limit)
+			break;
+		if(unlink(entry.path.c_str()) == 0) // another run may have removed it already
+			total -= entry.size;
+	}
+}
+
+// failing to store is not an error , the next run just misses again
+void cache_store(std::string dir , std::string key , const binarySource &bs , unsigned long long limit)
+{
+	std::string out = CACHE_MAGIC;
+	put_u16(out , bs.origin);
+	put_u32(out , bs.bytes.size());
+	out.append(bs.bytes.begin() , bs.bytes.end());
+	put_u32(out , bs.labels.size());
+	for(auto label : bs.labels)
+		put_u16(out , label);
+
+	mkdir(dir.c_str() , 0755);
+	std::string path = dir + "/" + key + CACHE_SUFFIX;
+	std::string temporary = path + ".tmp" + std::to_string(getpid()) + "-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	int fd = open(temporary.c_str() , O_WRONLY | O_CREAT | O_TRUNC , 0644);
+	if(fd < 0)
+		return;
+	bool written = write(fd , out.data() , out.size()) == (ssize_t)out.size();
+	close(fd);
+	if(!written || rename(temporary.c_str() , path.c_str()) != 0)
+	{
+		unlink(temporary.c_str());
+		return;
+	}
+	cache_evict(dir , limit);
+}
+
+/*=================================RUNNING IN THE VM=================================*/
+#define DEFAULT_MAX_CYCLES 100000000ULL
+
+void print_machine(const machine &m)
+{
+	static const char *STATUS[] = {"cycle limit reached" , "halted" , "undefined opcode"};
+	char line[128];
+	snprintf(line , sizeof(line) , "A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X F=%02X SP=%04X PC=%04X" ,
+		m.reg[REG_A] , m.reg[REG_B] , m.reg[REG_C] , m.reg[REG_D] , m.reg[REG_E] , m.reg[REG_H] , m.reg[REG_L] , m.F , m.SP , m.PC);
+	std::cout<<line<<std::endl;
+	std::cout<<STATUS[m.status]<<" after "<<m.instructions<<" instructions , "<<m.cycles<<" T-states"<<std::endl;
+}
+
+bool parse_hex(std::string text , unsigned long &value)
+{
+	if(!text.empty() && (text.back() == 'H' || text.back() == 'h'))
+		text.pop_back();
+	if(text.empty() || text.size() > 4)
+		return false;
+	auto r = std::from_chars(text.data() , text.data() + text.size() , value , 16);
+	return r.ec == std::errc() && r.ptr == text.data() + text.size();
+}
+
+// a decimal number , false unless all of text is one that fits in value
+bool parse_count(std::string_view text , unsigned long long &value)
+{
+	auto r = std::from_chars(text.data() , text.data() + text.size() , value);
+	return !text.empty() && r.ec == std::errc() && r.ptr == text.data() + text.size();
+}
+
+/*
+	--device SPEC puts a peripheral of devices.h on the bus of --run , SPEC is the kind and its settings , ports and
+	addresses in hex , period in T-states and irq one of 5.5 6.5 7.5 :
+		timer,port=10,period=1000,irq=7.5
+		uart,port=20,in=input.txt,out=-,period=1000,irq=6.5     (- is stdin or stdout , a fifo works too)
+		display,addr=8002,count=1   or   display,port=30
+*/
+device parse_device(const std::string &spec)
+{
+	std::stringstream items(spec);
+	std::string kind , item;
+	std::getline(items , kind , ',');
+	device d;
+	if(kind == "timer")
+		d.kind = DEVICE_TIMER;
+	else if(kind == "uart")
+		d.kind = DEVICE_UART;
+	else if(kind == "display")
+		d.kind = DEVICE_DISPLAY;
+	else
+		fail(1 , 0 , "unknown device " , kind);
+	d.out = stdout;
+	while(std::getline(items , item , ','))
+	{
+		size_t eq = item.find('=');
+		std::string key = item.substr(0 , eq) , value = eq == std::string::npos ? "" : item.substr(eq + 1);
+		unsigned long n = 0;
+		unsigned long long count = 0;
+		if(key == "port" && parse_hex(value , n) && n < 256)
+			d.port = n;
+		else if(key == "addr" && parse_hex(value , n))
+		{
+			d.first = n;
+			d.count = std::max(d.count , 1u);
+		}
+		else if(key == "count" && parse_count(value , count) && count > 0 && count <= 0x10000)
+			d.count = count;
+		else if(key == "period" && parse_count(value , count) && count > 0)
+			d.period = count;
+		else if(key == "irq" && (value == "5.5" || value == "6.5" || value == "7.5"))
+			d.irq = value[0] - '5';
+		else if(key == "in" && d.kind == DEVICE_UART && value != "")
+		{
+			d.in = value == "-" ? stdin : fopen(value.c_str() , "rb");
+			if(d.in == nullptr)
+				fail(1 , 0 , "cant open " , value);
+		}
+		else if(key == "out" && value != "")
+		{
+			d.out = value == "-" ? stdout : fopen(value.c_str() , "wb");
+			if(d.out == nullptr)
+				fail(1 , 0 , "cant open " , value);
+		}
+		else
+			fail(1 , 0 , "bad setting " , item , " of device " , kind);
+	}
+	if(d.kind != DEVICE_DISPLAY && d.port < 0)
+		fail(1 , 0 , kind , " needs a port");
+	if(d.kind == DEVICE_DISPLAY && (d.port < 0) == (d.count == 0))
+		fail(1 , 0 , "display needs either a port or an addr");
+	if(d.first + d.count > VM_MEMORY_SIZE)
+		fail(1 , 0 , "display runs past FFFF");
+	return d;
+}
+
+void print_devices(const device_bus &bus)
+{
+	char line[128];
+	for(const device &d : bus.devices)
+	{
+		if(d.kind == DEVICE_TIMER)
+			snprintf(line , sizeof(line) , "timer %02X : %llu ticks" , d.port , d.ticks);
+		else if(d.kind == DEVICE_UART)
+			snprintf(line , sizeof(line) , "uart %02X : %llu bytes received , %llu sent" , d.port , d.bytes_in , d.bytes_out);
+		else
+			snprintf(line , sizeof(line) , "display %0*X : %llu changes" , d.count > 0 ? 4 : 2 , d.count > 0 ? d.first : d.port , d.changes);
+		std::cout<<line<<std::endl;
+	}
+	if(!bus.devices.empty())
+		std::cout<<bus.interrupts<<" interrupts"<<std::endl;
+}
+
+/*
+	--record FILE writes the bytes the uarts received with the cycle and device they came at , one per line
+	("1500 0 104" , -1 for the end of the file). --replay FILE gives them back to the devices instead of their
+	files , the run repeats exactly even when the input was a pipe.
+*/
+void write_inputs(const std::string &filename , const device_bus &bus)
+{
+	std::ofstream out(filename);
+	if(!out)
+		fail(1 , 0 , "cant open " , filename);
+	for(const bus_input &input : bus.inputs)
+		out<<input.when<<" "<<input.device<<" "<<input.byte<<"\n";
+}
+
+std::vector<bus_input> read_inputs(const std::string &filename)
+{
+	std::ifstream in(filename);
+	if(!in)
+		fail(1 , 0 , "cant open " , filename);
+	std::vector<bus_input> inputs;
+	bus_input input;
+	while(in>>input.when>>input.device>>input.byte)
+		inputs.push_back(input);
+	if(!in.eof())
+		fail(1 , 0 , "bad input log " , filename);
+	return inputs;
+}
+
+// loads the assembled bytes straight into a machine and runs them from the start point , with devices on its bus if any
+void run_program(const binarySource &bs , unsigned long long max_cycles , bool use_cache , const std::vector<device> &devices ,
+	const std::string &record , const std::string &replay)
+{
+	auto m = std::make_unique<machine>();
+	vm_load(*m , bs.origin , bs.bytes.data() , bs.bytes.size());
+	auto cache = std::make_unique<block_cache>();
+	vm_add_leaders(*cache , bs.labels);
+	device_bus bus;
+	bus.devices = devices;
+	if(replay != "")
+		bus.inputs = read_inputs(replay);
+	for(const bus_input &input : bus.inputs)
+		if(input.device < 0 || input.device >= (int)devices.size() || devices[input.device].kind != DEVICE_UART)
+			fail(1 , 0 , "the input log " , replay , " does not fit the devices");
+	auto start = std::chrono::steady_clock::now();
+	if(!devices.empty())
+	{
+		bus_attach(*m , bus);
+		bus_run(*m , bus , use_cache ? cache.get() : nullptr , max_cycles);
+	}
+	else if(use_cache)
+		vm_run_cached(*m , *cache , max_cycles);
+	else
+		vm_run(*m , max_cycles);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	print_machine(*m);
+	print_devices(bus);
+	if(bus.diverged)
+		std::cout<<"the run went another way than the one recorded in "<<replay<<std::endl;
+	if(record != "")
+		write_inputs(record , bus);
+	std::cout<<"time "<<seconds<<" s , "<<(seconds > 0 ? m->instructions / seconds / 1e6 : 0)<<" MIPS"<<std::endl;
+	exit(m->status == VM_ILLEGAL ? 1 : 0);
+}
+
+/*
+	--profile NAME runs the program like --run under vm_run_profiled and writes NAME.lst , the source with the runs ,
+	T-states and share of every statement , one statement per row numbered like the lexer does , and NAME.folded , one line per chain of subroutines and label they spent
+	T-states under ("start;DELAY;LOOP 1234") for flamegraph tools.
+*/
+// the text of every statement , split where the lexer counts a line (a ';' right after a lexem) with the white
+// space between the lexems folded into one space
+std::vector<std::string> split_statements(std::string_view source)
+{
+	std::vector<std::string> statements(1);
+	for(size_t i = 0 ; i < source.size() ; i++)
+	{
+		std::string &text = statements.back();
+		if((unsigned char)source[i] > SPACE)
+			text += source[i];
+		else if(!text.empty() && text.back() != ' ')
+			text += ' ';
+		if(source[i] == EOL && i > 0 && !is_delimiter(source[i - 1]))
+		{
+			if(text.back() == ' ')
+				text.pop_back();
+			statements.emplace_back();
+		}
+	}
+	if(!statements.back().empty() && statements.back().back() == ' ')
+		statements.back().pop_back();
+	if(statements.back().empty())
+		statements.pop_back();
+	return statements;
+}
+
+void write_profile(const vm_profile &p , const binarySource &bs , const program_map &map , std::string_view source ,
+	const std::vector<std::string> &region_names , const std::string &name)
+{
+	unsigned long long total = 0;
+	for(auto c : p.cycles)
+		total += c;
+
+	std::vector<unsigned long long> line_hits , line_cycles;
+	std::vector<int> line_addr;
+	for(auto &line : map.lines)
+	{
+		if(line.second >= (int)line_hits.size())
+		{
+			line_hits.resize(line.second + 1);
+			line_cycles.resize(line.second + 1);
+			line_addr.resize(line.second + 1 , -1);
+		}
+		unsigned short addr = bs.origin + line.first;
+		if(line_addr[line.second] < 0)
+		{
+			line_addr[line.second] = addr;
+			line_hits[line.second] = p.hits[addr];
+		}
+		line_cycles[line.second] += p.cycles[addr];
+	}
+	std::ofstream listing(name + ".lst");
+	char row[64];
+	snprintf(row , sizeof(row) , "%12s %14s %7s %4s %5s  " , "runs" , "T-states" , "%" , "addr" , "line");
+	listing<<row<<"source"<<std::endl;
+	std::vector<std::string> statements = split_statements(source);
+	for(int line_no = 1 ; line_no <= (int)statements.size() ; line_no++)
+	{
+		if(line_no < (int)line_addr.size() && line_addr[line_no] >= 0)
+			snprintf(row , sizeof(row) , "%12llu %14llu %6.2f%% %04X %5d  " , line_hits[line_no] , line_cycles[line_no] ,
+				total ? 100.0 * line_cycles[line_no] / total : 0.0 , line_addr[line_no] , line_no);
+		else
+			snprintf(row , sizeof(row) , "%12s %14s %7s %4s %5d  " , "" , "" , "" , "" , line_no);
+		listing<<row<<statements[line_no - 1]<<std::endl;
+	}
+
+	std::ofstream folded(name + ".folded");
+	std::vector<std::string> paths(p.nodes.size());
+	for(size_t node = 0 ; node < p.nodes.size() ; node++) // a parent always comes before its children
+	{
+		const vm_profile_node &n = p.nodes[node];
+		std::string frame = "start";
+		if(n.parent >= 0)
+		{
+			auto label = std::lower_bound(map.labels.begin() , map.labels.end() , std::make_pair(n.entry - (int)bs.origin , std::string()));
+			snprintf(row , sizeof(row) , "%04X" , n.entry); // not called at a label
+			frame = label != map.labels.end() && label->first == n.entry - bs.origin ? label->second : row;
+		}
+		paths[node] = n.parent < 0 ? frame : paths[n.parent] + ";" + frame;
+		for(int region = 0 ; region < (int)n.cycles.size() ; region++)
+			if(n.cycles[region] > 0)
+			{
+				folded<<paths[node];
+				if(region_names[region] != frame)
+					folded<<";"<<region_names[region];
+				folded<<" "<<n.cycles[region]<<std::endl;
+			}
+	}
+}
+
+// runs like run_program counting every address , then writes the listing and folded stacks
+void profile_program(const binarySource &bs , const program_map &map , std::string_view source , unsigned long long max_cycles ,
+	const std::string &name)
+{
+	auto m = std::make_unique<machine>();
+	vm_load(*m , bs.origin , bs.bytes.data() , bs.bytes.size());
+	auto p = std::make_unique<vm_profile>();
+	std::vector<std::string> region_names = { "outside" , "start" }; // not the program , code before the first label
+	std::vector<int> region_start = { -1 , 0 };
+	for(auto &label : map.labels)
+		if(region_start.size() == 2 || region_start.back() != label.first) // the first of the labels at an address names it
+		{
+			region_names.push_back(label.second);
+			region_start.push_back(label.first);
+		}
+	p->regions = region_names.size();
+	for(int offset = 0 , region = 1 ; offset < (int)bs.bytes.size() ; offset++)
+	{
+		while(region + 1 < p->regions && region_start[region + 1] <= offset)
+			region++;
+		p->region[(unsigned short)(bs.origin + offset)] = region;
+	}
+	auto start = std::chrono::steady_clock::now();
+	vm_run_profiled(*m , max_cycles , *p);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	print_machine(*m);
+	std::cout<<"time "<<seconds<<" s , "<<(seconds > 0 ? m->instructions / seconds / 1e6 : 0)<<" MIPS"<<std::endl;
+	write_profile(*p , bs , map , source , region_names , name);
+	std::cout<<"profile written to "<<name<<".lst and "<<name<<".folded"<<std::endl;
+	exit(m->status == VM_ILLEGAL ? 1 : 0);
+}
+
+
+/*=============================CONTROL FLOW ANALYSIS=================================*/
+/*
+	--cfg splits the program into basic blocks at labels , jump , call and RST targets and after every instruction
+	that ends a block in the VM (vm_ends_block) , and prints the graph with its loops as JSON.
+	an edge costs the T-states of the last instruction of its block going that way , taken or not taken , and a
+	CALL going in adds the worst path of the subroutine. back edges are found by a depth first search from the start
+	point and the subroutines , a loop is its header with the blocks that reach a back edge to it without passing it.
+	worst_path is the most T-states from a block to a RET , HLT , PCHL or the end of the code going round no loop ,
+	worst_iteration the most T-states from a loop header round to it again with inner loops gone through once.
+*/
+struct cfg_edge
+{
+	int to; // block , -1 leaves the code (RET , HLT , PCHL , a jump outside or the end)
+	int cost; // T-states of the last instruction of the block going this way
+	bool calls = false; // goes through the subroutine first
+	bool back = false;
+};
+
+struct cfg_block
+{
+	int start , end; // offsets from the origin
+	int last; // offset of the last instruction
+	int instructions = 0;
+	int body = 0; // T-states of all but the last instruction
+	int call = -1; // subroutine a CALL , Ccc or RST at the end goes to
+	bool recursive = false; // the call goes back into a subroutine that is still running
+	std::vector<cfg_edge> succ;
+	long worst = 0; // worst path from here
+};
+
+struct cfg_loop
+{
+	int header;
+	std::vector<int> blocks;
+	std::vector<int> latches; // blocks with a back edge to the header
+	long worst_iteration = 0;
+};
+
+struct control_flow_graph
+{
+	std::vector<cfg_block> blocks;
+	std::vector<int> entries; // the start point and every subroutine
+	std::vector<cfg_loop> loops;
+	std::vector<int> post; // blocks in the order the search left them , successors first
+};
+
+control_flow_graph build_cfg(const binarySource &bs)
+{
+	const int size = bs.bytes.size();
+	auto in_code = [&](int addr) { return addr - bs.origin >= 0 && addr - bs.origin < size ? addr - bs.origin : -1; };
+	std::vector<unsigned char> leader(size + 1);
+	leader[0] = 1;
+	for(unsigned short label : bs.labels)
+		if(in_code(label) >= 0)
+			leader[label - bs.origin] = 1;
+	for(int pos = 0 ; pos < size ; )
+	{
+		unsigned char op = bs.bytes[pos];
+		int length = OPCODE_TABLE[op].mnemonic == NO_MNEMONIC ? 1 : OPCODE_TABLE[op].length;
+		if((is_jump_opcode(op) || is_call_opcode(op)) && pos + 2 < size && in_code(bs.bytes[pos+1] | bs.bytes[pos+2] << 8) >= 0)
+			leader[in_code(bs.bytes[pos+1] | bs.bytes[pos+2] << 8)] = 1;
+		if((op & 0xC7) == 0xC7 && in_code(op & 0x38) >= 0) // RST n
+			leader[in_code(op & 0x38)] = 1;
+		pos += length;
+		if(vm_ends_block(op) && pos < size)
+			leader[pos] = 1;
+	}
+
+	control_flow_graph g;
+	std::vector<int> block_at(size + 1 , -1);
+	for(int pos = 0 ; pos < size ; )
+	{
+		cfg_block b;
+		b.start = pos;
+		unsigned char op;
+		do
+		{
+			b.last = pos;
+			op = bs.bytes[pos];
+			b.body += OPCODE_TABLE[op].t_max;
+			b.instructions++;
+			pos += OPCODE_TABLE[op].mnemonic == NO_MNEMONIC ? 1 : OPCODE_TABLE[op].length;
+		}
+		while(pos < size && !leader[pos] && !vm_ends_block(op));
+		b.end = std::min(pos , size);
+		b.body -= OPCODE_TABLE[op].t_max;
+		block_at[b.start] = g.blocks.size();
+		g.blocks.push_back(b);
+	}
+	for(auto &b : g.blocks) // the last instruction decides where it goes
+	{
+		unsigned char op = bs.bytes[b.last];
+		const opcode_def &d = OPCODE_TABLE[op];
+		int next = b.end < size ? block_at[b.end] : -1;
+		int target = d.length == 3 && b.last + 2 < size ? in_code(bs.bytes[b.last+1] | bs.bytes[b.last+2] << 8) : -1;
+		if(target >= 0)
+			target = block_at[target];
+		if(op == 0xC3) // JMP
+			b.succ.push_back({ target , d.t_max });
+		else if((op & 0xC7) == 0xC2) // Jcc
+		{
+			b.succ.push_back({ target , d.t_max });
+			b.succ.push_back({ next , d.t_min });
+		}
+		else if(op == 0xCD || (op & 0xC7) == 0xC7) // CALL , RST n
+		{
+			b.call = op == 0xCD ? target : (in_code(op & 0x38) >= 0 ? block_at[in_code(op & 0x38)] : -1);
+			b.succ.push_back({ next , d.t_max , b.call >= 0 });
+		}
+		else if((op & 0xC7) == 0xC4) // Ccc
+		{
+			b.call = target;
+			b.succ.push_back({ next , d.t_max , b.call >= 0 });
+			b.succ.push_back({ next , d.t_min });
+		}
+		else if(op == 0xC9 || op == 0xE9 || op == 0x76 || d.mnemonic == NO_MNEMONIC) // RET , PCHL , HLT
+			b.succ.push_back({ -1 , d.t_max });
+		else if((op & 0xC7) == 0xC0) // Rcc
+		{
+			b.succ.push_back({ -1 , d.t_max });
+			b.succ.push_back({ next , d.t_min });
+		}
+		else
+			b.succ.push_back({ next , d.t_max });
+	}
+
+	// depth first search over the edges and calls , iterative so long programs do not run out of stack
+	const int n = g.blocks.size();
+	if(n > 0)
+		g.entries.push_back(0);
+	for(auto &b : g.blocks)
+		if(b.call >= 0 && std::find(g.entries.begin() , g.entries.end() , b.call) == g.entries.end())
+			g.entries.push_back(b.call);
+	std::vector<int> roots = g.entries;
+	for(int i = 0 ; i < n ; i++)
+		roots.push_back(i);
+	std::vector<char> state(n); // 0 not seen , 1 on the stack , 2 left
+	std::vector<std::pair<int , int>> stack; // block , next edge , the call is the edge after the last successor
+	for(int root : roots)
+	{
+		if(state[root] != 0)
+			continue;
+		stack.push_back({ root , 0 });
+		state[root] = 1;
+		while(!stack.empty())
+		{
+			int v = stack.back().first;
+			int e = stack.back().second++;
+			cfg_block &b = g.blocks[v];
+			if(e > (int)b.succ.size())
+			{
+				state[v] = 2;
+				g.post.push_back(v);
+				stack.pop_back();
+				continue;
+			}
+			int to = e < (int)b.succ.size() ? b.succ[e].to : b.call;
+			if(to < 0)
+				continue;
+			if(state[to] == 1)
+			{
+				if(e < (int)b.succ.size())
+					b.succ[e].back = true;
+				else
+					b.recursive = true;
+			}
+			else if(state[to] == 0)
+			{
+				state[to] = 1;
+				stack.push_back({ to , 0 });
+			}
+		}
+	}
+
+	// successors and subroutines are left before the blocks going to them
+	for(int v : g.post)
+	{
+		cfg_block &b = g.blocks[v];
+		b.worst = 0;
+		for(auto &e : b.succ)
+		{
+			long cost = e.cost + (e.calls && !b.recursive ? g.blocks[b.call].worst : 0) + (e.to >= 0 && !e.back ? g.blocks[e.to].worst : 0);
+			b.worst = std::max(b.worst , cost);
+		}
+		b.worst += b.body;
+	}
+
+	std::vector<std::vector<int>> preds(n);
+	for(int v = 0 ; v < n ; v++)
+		for(auto &e : g.blocks[v].succ)
+			if(e.to >= 0)
+				preds[e.to].push_back(v);
+	std::vector<int> order(n); // place of every block in post
+	for(int i = 0 ; i < n ; i++)
+		order[g.post[i]] = i;
+	std::vector<int> loop_of(n , -1); // header => index in loops
+	for(int v = 0 ; v < n ; v++)
+		for(auto &e : g.blocks[v].succ)
+		{
+			if(!e.back)
+				continue;
+			if(loop_of[e.to] < 0)
+			{
+				loop_of[e.to] = g.loops.size();
+				g.loops.push_back({ e.to , { e.to } , {} });
+			}
+			cfg_loop &loop = g.loops[loop_of[e.to]];
+			if(std::find(loop.latches.begin() , loop.latches.end() , v) == loop.latches.end())
+				loop.latches.push_back(v);
+		}
+	for(auto &loop : g.loops)
+	{
+		std::vector<unsigned char> inside(n);
+		inside[loop.header] = 1;
+		std::vector<int> work = loop.latches;
+		while(!work.empty())
+		{
+			int v = work.back();
+			work.pop_back();
+			if(inside[v])
+				continue;
+			inside[v] = 1;
+			loop.blocks.push_back(v);
+			for(int p : preds[v])
+				work.push_back(p);
+		}
+		std::sort(loop.blocks.begin() , loop.blocks.end() , [&](int a , int b) { return order[a] < order[b]; });
+		std::vector<long> iteration(n , -1); // most T-states from the block round to the header , -1 if it cannot get there
+		for(int v : loop.blocks)
+		{
+			cfg_block &b = g.blocks[v];
+			for(auto &e : b.succ)
+			{
+				long rest = e.to == loop.header && e.back ? 0 : (e.to >= 0 && inside[e.to] && !e.back ? iteration[e.to] : -1);
+				if(rest < 0)
+					continue;
+				long cost = b.body + e.cost + (e.calls && !b.recursive ? g.blocks[b.call].worst : 0) + rest;
+				iteration[v] = std::max(iteration[v] , cost);
+			}
+		}
+		loop.worst_iteration = iteration[loop.header];
+		std::sort(loop.blocks.begin() , loop.blocks.end());
+	}
+	return g;
+}
+
+void write_cfg_json(const control_flow_graph &g , const binarySource &bs , const program_map &map , std::ostream &out)
+{
+	auto label_at = [&](int offset) {
+		auto it = std::lower_bound(map.labels.begin() , map.labels.end() , std::make_pair(offset , std::string()));
+		return it != map.labels.end() && it->first == offset ? it->second : std::string();
+	};
+	auto line_at = [&](int offset) {
+		auto it = std::lower_bound(map.lines.begin() , map.lines.end() , std::make_pair(offset , 0));
+		return it != map.lines.end() && it->first == offset ? it->second : 0;
+	};
+	auto list = [&](const std::vector<int> &items) {
+		std::string text = "[";
+		for(size_t i = 0 ; i < items.size() ; i++)
+			text += (i ? ", " : "") + std::to_string(items[i]);
+		return text + "]";
+	};
+
+	out<<"{\n  \"origin\": "<<bs.origin<<",\n  \"bytes\": "<<bs.bytes.size()<<",\n  \"blocks\": [";
+	for(size_t i = 0 ; i < g.blocks.size() ; i++)
+	{
+		const cfg_block &b = g.blocks[i];
+		long t_min = LONG_MAX , t_max = 0;
+		std::vector<int> successors;
+		bool exits = false;
+		for(auto &e : b.succ)
+		{
+			t_min = std::min<long>(t_min , b.body + e.cost);
+			t_max = std::max<long>(t_max , b.body + e.cost);
+			if(e.to < 0)
+				exits = true;
+			else if(std::find(successors.begin() , successors.end() , e.to) == successors.end())
+				successors.push_back(e.to);
+		}
+		out<<(i ? ",\n" : "\n")<<"    {\"id\": "<<i<<", \"start\": "<<bs.origin + b.start<<", \"end\": "<<bs.origin + b.end
+			<<", \"label\": \""<<label_at(b.start)<<"\", \"line\": "<<line_at(b.start)<<", \"bytes\": "<<b.end - b.start
+			<<", \"instructions\": "<<b.instructions<<", \"t_min\": "<<t_min<<", \"t_max\": "<<t_max
+			<<", \"successors\": "<<list(successors)<<", \"exits\": "<<(exits ? "true" : "false")
+			<<", \"calls\": "<<b.call<<", \"worst_path\": "<<b.worst<<"}";
+	}
+	out<<"\n  ],\n  \"entries\": [";
+	for(size_t i = 0 ; i < g.entries.size() ; i++)
+	{
+		const cfg_block &b = g.blocks[g.entries[i]];
+		out<<(i ? ",\n" : "\n")<<"    {\"block\": "<<g.entries[i]<<", \"label\": \""<<label_at(b.start)<<"\", \"worst_path\": "<<b.worst<<"}";
+	}
+	out<<"\n  ],\n  \"loops\": [";
+	for(size_t i = 0 ; i < g.loops.size() ; i++)
+	{
+		const cfg_loop &loop = g.loops[i];
+		out<<(i ? ",\n" : "\n")<<"    {\"header\": "<<loop.header<<", \"label\": \""<<label_at(g.blocks[loop.header].start)
+			<<"\", \"blocks\": "<<list(loop.blocks)<<", \"latches\": "<<list(loop.latches)<<", \"worst_iteration\": "<<loop.worst_iteration<<"}";
+	}
+	bool recursive = false;
+	for(auto &b : g.blocks)
+		recursive = recursive || b.recursive;
+	out<<"\n  ],\n  \"recursive\": "<<(recursive ? "true" : "false")<<"\n}\n";
+}
+
+/*==================================BATCH RUNNER=====================================*/
+/*
+	--batch runs every job of a manifest , one job per line :
+		<program> [start=8000] [cycles=N] [warmup=8040 | warmup=+N] [settings] => [expected]
+	a setting or an expectation is a register (A=05 , SP=FFFF , F=01) , memory from an address on (@9000=01,02,03)
+	or a port (P01=42). values are hex. a job passes when its program halts within its cycles and every expected
+	value holds. each program is assembled once for all of its jobs , then the jobs run on their own machines on
+	all cores , a free worker takes the next job so long and short runs even out.
+	warmup runs the program once up to an address (or for N T-states) and takes a snapshot , its jobs start from
+	the snapshot with their settings applied there. cycles still count from the start point.
+*/
+struct batch_value
+{
+	char kind; // 'R' register , 'F' flags , 'S' stack pointer , 'M' memory , 'P' port
+	int where; // register code , address or port
+	std::vector<unsigned char> bytes;
+};
+
+struct batch_job
+{
+	int line_no;
+	std::string program; // relative to the manifest
+	std::string start_point = "8000";
+	unsigned long long max_cycles = DEFAULT_MAX_CYCLES;
+	std::string warmup = "";
+	std::vector<batch_value> settings;
+	std::vector<batch_value> expected;
+	size_t program_index = 0;
+
+	bool passed = false;
+	unsigned long long cycles = 0;
+	unsigned long long instructions = 0;
+	std::string reason; // why it failed
+};
+
+struct batch_program
+{
+	std::string path;
+	std::string start_point;
+	std::string warmup;
+	binarySource code;
+	std::string error; // assembly or warm-up error , every job of the program fails with it
+	std::unique_ptr<vm_snapshot> snapshot; // after the warm-up
+};
+
+// A=05 , SP=FFFF , @9000=01,02 or P01=42
+batch_value parse_batch_value(const std::string &item , int line_no)
+{
+	size_t eq = item.find('=');
+	std::string name = item.substr(0 , eq == std::string::npos ? 0 : eq);
+	std::string values = eq == std::string::npos ? "" : item.substr(eq + 1);
+	batch_value v = { 0 , 0 , {} };
+	unsigned long n;
+	if(register_code(name) >= 0 && name != "M")
+		v = { 'R' , register_code(name) , {} };
+	else if(name == "F")
+		v = { 'F' , 0 , {} };
+	else if(name == "SP")
+		v = { 'S' , 0 , {} };
+	else if(name.size() > 1 && name[0] == '@' && parse_hex(name.substr(1) , n))
+		v = { 'M' , (int)n , {} };
+	else if(name.size() > 1 && name[0] == 'P' && parse_hex(name.substr(1) , n) && n < 256)
+		v = { 'P' , (int)n , {} };
+	else
+		fail(1 , line_no , "bad manifest entry " , item , " at line " , line_no);
+
+	std::stringstream list(values);
+	std::string byte;
+	while(std::getline(list , byte , ','))
+	{
+		if(!parse_hex(byte , n) || (n > 0xFF && v.kind != 'S'))
+			fail(1 , line_no , "bad value in manifest entry " , item , " at line " , line_no);
+		if(v.kind == 'S')
+		{
+			v.bytes.push_back(n & 0xFF);
+			v.bytes.push_back(n >> 8);
+		}
+		else
+			v.bytes.push_back(n);
+	}
+	size_t wanted = v.kind == 'S' ? 2 : 1;
+	if(v.bytes.size() < wanted || (v.kind != 'M' && v.bytes.size() != wanted))
+		fail(1 , line_no , "bad value in manifest entry " , item , " at line " , line_no);
+	return v;
+}
+
+std::vector<batch_job> read_manifest(const std::string &manifest)
+{
+	std::ifstream in(manifest);
+	if(!in)
+		fail(1 , 0 , "cannot open manifest " , manifest);
+	std::string dir = directory_of(manifest);
+	std::vector<batch_job> jobs;
+	std::string line;
+	for(int line_no = 1 ; std::getline(in , line) ; line_no++)
+	{
+		std::stringstream words(line.substr(0 , line.find('#')));
+		std::string word;
+		if(!(words >> word))
+			continue;
+		batch_job job;
+		job.line_no = line_no;
+		job.program = word[0] == '/' ? word : dir + "/" + word;
+		bool expected = false;
+		while(words >> word)
+		{
+			if(word == "=>")
+				expected = true;
+			else if(!expected && word.compare(0 , 6 , "start=") == 0 && is_start_point(word.substr(6)))
+				job.start_point = word.substr(6);
+			else if(!expected && word.compare(0 , 7 , "cycles=") == 0)
+			{
+				if(!parse_count(std::string_view(word).substr(7) , job.max_cycles))
+					fail(1 , line_no , "bad manifest entry " , word , " at line " , line_no);
+			}
+			else if(!expected && word.compare(0 , 7 , "warmup=") == 0)
+			{
+				unsigned long n;
+				unsigned long long cycles;
+				job.warmup = word.substr(7);
+				if(job.warmup.empty() || (job.warmup[0] == '+' ? !parse_count(std::string_view(job.warmup).substr(1) , cycles) :
+					!parse_hex(job.warmup , n)))
+					fail(1 , line_no , "bad manifest entry " , word , " at line " , line_no);
+			}
+			else
+				(expected ? job.expected : job.settings).push_back(parse_batch_value(word , line_no));
+		}
+		jobs.push_back(std::move(job));
+	}
+	return jobs;
+}
+
+void batch_assemble(batch_program &p , include_cache &includes)
+{
+	try
+	{
+		auto b = readfile(p.path.c_str());
+		diagnostic_list errors;
+		auto st = lex_analyse_source(b.view() , &errors);
+		if(has_directives(st))
+		{
+			check_diagnostics(&errors);
+			st = preprocess_source(st , includes , directory_of(p.path));
+		}
+		p.code = parse_symbol_table(st , p.start_point , &errors);
+	}
+	catch(const assembly_error &e)
+	{
+		p.error = e.message;
+	}
+	catch(const assembly_errors &e)
+	{
+		p.error = e.list.front().message;
+	}
+}
+
+// runs the program up to its warm-up address or for its warm-up T-states and keeps the machine there
+void batch_warmup(batch_program &p)
+{
+	auto m = std::make_unique<machine>();
+	vm_load(*m , p.code.origin , p.code.bytes.data() , p.code.bytes.size());
+	unsigned long pc = 0;
+	unsigned long long cycles = 0;
+	if(p.warmup[0] == '+' && parse_count(std::string_view(p.warmup).substr(1) , cycles)) // checked by read_manifest
+		vm_run(*m , cycles);
+	else if(parse_hex(p.warmup , pc))
+		vm_run_to(*m , pc , DEFAULT_MAX_CYCLES);
+	if(m->status != VM_RUNNING || (p.warmup[0] != '+' && m->PC != pc))
+		p.error = "warmup did not reach " + p.warmup;
+	else
+		p.snapshot = std::make_unique<vm_snapshot>(vm_take_snapshot(*m));
+}
+
+void batch_apply(machine &m , const batch_value &v)
+{
+	switch(v.kind)
+	{
+		case 'R' : m.reg[v.where] = v.bytes[0]; break;
+		case 'F' : m.F = v.bytes[0]; break;
+		case 'S' : m.SP = v.bytes[0] | v.bytes[1] << 8; break;
+		case 'P' : m.ports[v.where] = v.bytes[0]; break;
+		case 'M' :
+			for(size_t i = 0 ; i < v.bytes.size() ; i++)
+				vm_write<false>(m , v.where + i , v.bytes[i]); // drops cached code under it
+			break;
+	}
+}
+
+// the first byte that differs from what is expected , -1 if none
+int batch_mismatch(const machine &m , const batch_value &v , unsigned char &got)
+{
+	for(size_t i = 0 ; i < v.bytes.size() ; i++)
+	{
+		switch(v.kind)
+		{
+			case 'R' : got = m.reg[v.where]; break;
+			case 'F' : got = m.F; break;
+			case 'S' : got = i == 0 ? m.SP & 0xFF : m.SP >> 8; break;
+			case 'P' : got = m.ports[v.where]; break;
+			case 'M' : got = m.memory[(unsigned short)(v.where + i)]; break;
+		}
+		if(got != v.bytes[i])
+			return i;
+	}
+	return -1;
+}
+
+void batch_run(batch_job &job , const batch_program &p , bool use_cache)
+{
+	if(p.error != "")
+	{
+		job.reason = p.error;
+		return;
+	}
+	// every worker keeps its machine and block cache , allocating them per job costs more than a short run
+	thread_local std::unique_ptr<machine> m;
+	thread_local std::unique_ptr<block_cache> cache;
+	if(m == nullptr)
+	{
+		m = std::make_unique<machine>();
+		cache = std::make_unique<block_cache>();
+	}
+	*m = machine();
+	if(p.snapshot != nullptr)
+		vm_restore_snapshot(*m , *p.snapshot);
+	else
+		vm_load(*m , p.code.origin , p.code.bytes.data() , p.code.bytes.size());
+	for(auto &v : job.settings)
+		batch_apply(*m , v);
+	if(use_cache)
+	{
+		vm_clear_cache(*cache);
+		vm_add_leaders(*cache , p.code.labels);
+		vm_run_cached(*m , *cache , job.max_cycles);
+	}
+	else
+		vm_run(*m , job.max_cycles);
+	job.cycles = m->cycles;
+	job.instructions = m->instructions;
+
+	char text[96];
+	if(m->status == VM_RUNNING)
+	{
+		job.reason = "cycle limit reached";
+		return;
+	}
+	if(m->status == VM_ILLEGAL)
+	{
+		snprintf(text , sizeof(text) , "undefined opcode at %04X" , m->PC);
+		job.reason = text;
+		return;
+	}
+	for(auto &v : job.expected)
+	{
+		unsigned char got;
+		int i = batch_mismatch(*m , v , got);
+		if(i < 0)
+			continue;
+		if(v.kind == 'M')
+			snprintf(text , sizeof(text) , "@%04X=%02X expected %02X" , (unsigned short)(v.where + i) , got , v.bytes[i]);
+		else if(v.kind == 'P')
+			snprintf(text , sizeof(text) , "P%02X=%02X expected %02X" , v.where , got , v.bytes[i]);
+		else if(v.kind == 'S')
+			snprintf(text , sizeof(text) , "SP=%04X expected %04X" , m->SP , v.bytes[0] | v.bytes[1] << 8);
+		else
+			snprintf(text , sizeof(text) , "%s=%02X expected %02X" , v.kind == 'F' ? "F" : std::string(REGISTER_NAMES[v.where]).c_str() , got , v.bytes[i]);
+		job.reason = text;
+		return;
+	}
+	job.passed = true;
+}
+
+void run_batch(const std::string &manifest , int threads , bool use_cache)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<batch_job> jobs = read_manifest(manifest);
+
+	std::vector<batch_program> programs;
+	std::unordered_map<std::string , size_t> program_index; // path , start point and warm-up => index in programs
+	for(auto &job : jobs)
+	{
+		auto found = program_index.emplace(job.program + " " + job.start_point + " " + job.warmup , programs.size());
+		if(found.second)
+			programs.push_back({ job.program , job.start_point , job.warmup , {} , "" , nullptr });
+		job.program_index = found.first->second;
+	}
+	include_cache includes;
+	parallel_for(programs.size() , threads , [&](int i) {
+		batch_assemble(programs[i] , includes);
+		if(programs[i].warmup != "" && programs[i].error == "")
+			batch_warmup(programs[i]);
+	});
+	double assembled = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	parallel_for(jobs.size() , threads , [&](int i) { batch_run(jobs[i] , programs[jobs[i].program_index] , use_cache); });
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t passed = 0;
+	unsigned long long cycles = 0 , instructions = 0;
+	for(auto &job : jobs)
+	{
+		passed += job.passed;
+		cycles += job.cycles;
+		instructions += job.instructions;
+		std::cout<<job.line_no<<" "<<(job.passed ? "pass " : "fail ")<<job.program<<" "<<job.cycles<<" T-states";
+		if(!job.passed)
+			std::cout<<" : "<<job.reason;
+		std::cout<<std::endl;
+	}
+	std::cout<<"passed "<<passed<<"/"<<jobs.size()<<" jobs of "<<programs.size()<<" programs , "<<cycles<<" T-states"<<std::endl;
+	std::cout<<"time "<<seconds<<" s ("<<assembled<<" s assembling) , "<<(seconds > 0 ? jobs.size() / seconds : 0)<<" jobs/s , "
+		<<(seconds > 0 ? instructions / seconds / 1e6 : 0)<<" MIPS on "<<threads<<" threads"<<std::endl;
+	exit(passed == jobs.size() ? 0 : 1);
+}
+
+
+/*===============================LIBRARY AND SERVER==================================*/
+assembly_result assemble_source(std::string_view source , std::string start_point)
+{
+	assembly_result result;
+	try
+	{
+		include_cache includes;
+		diagnostic_list errors;
+		symbol_table st = lex_analyse_source(source , &errors);
+		if(has_directives(st))
+		{
+			check_diagnostics(&errors);
+			st = preprocess_source(st , includes , ".");
+		}
+		binarySource ts = parse_symbol_table(st , start_point , &errors);
+		result.ok = true;
+		result.origin = ts.origin;
+		result.bytes = std::move(ts.bytes);
+	}
+	catch(const assembly_error &e)
+	{
+		result.diagnostics.push_back({ e.line_no , e.message });
+	}
+	catch(const assembly_errors &e)
+	{
+		for(auto &error : e.list)
+			result.diagnostics.push_back({ error.line_no , error.message });
+	}
+	catch(const std::exception &e) // a bad start point or running out of memory
+	{
+		result.diagnostics.push_back({ 0 , e.what() });
+	}
+	return result;
+}
+
+assembly_result assemble_file(const char *filename , std::string start_point)
+{
+	try
+	{
+		auto b = readfile(filename);
+		return assemble_source(b.view() , start_point);
+	}
+	catch(const assembly_error &e)
+	{
+		assembly_result result;
+		result.diagnostics.push_back({ e.line_no , e.message });
+		return result;
+	}
+}
+
+/*
+	incremental assembly keeps the source as a list of statements , the text up to and including a ';' , with
+	their tokens and encoded bytes. an update keeps the statements shared with the last source at the front and at
+	the back and only lexes and encodes the ones in between. the statements behind them move by the change in
+	length , so only the labels defined in the new statements or behind them moved and only their uses are patched.
+*/
+struct label_info;
+
+struct cached_statement
+{
+	std::string text;
+	symbol_table tokens;
+	std::vector<unsigned char> bytes;
+	std::vector<std::string_view> labels; // labels defined by the statement
+	std::vector<label_reference> references; // pos is the offset in bytes
+	std::vector<label_info *> defined , used; // labels and references looked up in the label table
+	std::string error;
+	int error_line = 0;
+	int index = 0; // line number - 1
+	int address = 0; // offset from the origin
+};
+
+struct label_info
+{
+	std::string name;
+	std::vector<cached_statement *> definitions , uses;
+};
+
+struct incremental_assembler::state
+{
+	unsigned short origin;
+	std::vector<std::unique_ptr<cached_statement>> statements;
+	std::unordered_map<std::string , label_info> labels;
+	int errors = 0; // statements holding an error
+	std::vector<unsigned char> bytes; // of every statement in order , kept while the source has errors
+	assembly_result result; // without bytes while the source has errors , as assemble_source
+};
+
+incremental_assembler::incremental_assembler(std::string start_point) : s(new state)
+{
+	s->origin = stoi(start_point , nullptr , 16);
+	s->result.ok = true;
+	s->result.origin = s->origin;
+}
+
+incremental_assembler::~incremental_assembler() = default;
+
+// lexes and encodes a statement on its own , its label operands are left zero
+void encode_statement(cached_statement &st)
+{
+	st.tokens.clear();
+	st.bytes.clear();
+	st.labels.clear();
+	st.references.clear();
+	st.error.clear();
+	try
+	{
+		int line_no = st.index + 1;
+		lex_analyse_chunk(st.text , st.tokens , line_no);
+		assembly_state as;
+		as.relocatable = true;
+		parse_statements(st.tokens , as);
+		for(size_t label = 0 ; label < as.LABEL_TABLE.size() ; label++)
+			if(as.LABEL_TABLE[label].mem_loc >= 0)
+				st.labels.push_back(as.symbols->name(label));
+		st.references = std::move(as.references);
+		st.bytes = std::move(as.TRANSLATED_SOURCE.bytes);
+	}
+	catch(const assembly_error &e)
+	{
+		st.bytes.clear();
+		st.labels.clear();
+		st.references.clear();
+		st.error = e.message;
+		st.error_line = e.line_no;
+	}
+}
+
+label_info *find_label_info(incremental_assembler::state &s , std::string_view label)
+{
+	auto it = s.labels.emplace(std::string(label) , label_info()).first;
+	it->second.name = it->first;
+	return &it->second;
+}
+
+void forget_statement(incremental_assembler::state &s , cached_statement *st)
+{
+	auto drop = [&](std::vector<cached_statement *> &list , label_info *info) {
+		list.erase(std::find(list.begin() , list.end() , st));
+		if(info->definitions.empty() && info->uses.empty())
+			s.labels.erase(info->name);
+	};
+	for(label_info *info : st->defined)
+		drop(info->definitions , info);
+	for(label_info *info : st->used)
+		drop(info->uses , info);
+	if(!st->error.empty())
+		s.errors--;
+}
+
+void learn_statement(incremental_assembler::state &s , cached_statement *st)
+{
+	st->defined.clear();
+	st->used.clear();
+	for(auto label : st->labels)
+	{
+		st->defined.push_back(find_label_info(s , label));
+		st->defined.back()->definitions.push_back(st);
+	}
+	for(auto &ref : st->references)
+	{
+		st->used.push_back(find_label_info(s , st->tokens.symbols->name(ref.label)));
+		st->used.back()->uses.push_back(st);
+	}
+	if(!st->error.empty())
+		s.errors++;
+}
+
+// writes the address of every label st uses into the output
+void patch_statement(incremental_assembler::state &s , cached_statement *st)
+{
+	for(size_t k = 0 ; k < st->references.size() ; k++)
+	{
+		label_info *info = st->used[k];
+		if(info->definitions.empty())
+			continue; // reported as unresolved
+		unsigned short addr = s.origin + info->definitions[0]->address;
+		int pos = st->address + st->references[k].pos;
+		s.bytes[pos] = addr & 0xFF;
+		s.bytes[pos + 1] = addr >> BINARY_WORD_SIZE;
+	}
+}
+
+const assembly_result &incremental_assembler::update(std::string_view source)
+{
+	std::vector<std::string_view> texts;
+	for(size_t pos = 0 ; pos < source.size() ; )
+	{
+		size_t end = source.find(EOL , pos);
+		end = end == std::string_view::npos ? source.size() : end + 1;
+		texts.push_back(source.substr(pos , end - pos));
+		pos = end;
+	}
+
+	auto &old = s->statements;
+	size_t front = 0 , back = 0;
+	while(front < old.size() && front < texts.size() && old[front]->text == texts[front])
+		front++;
+	while(back < old.size() - front && back < texts.size() - front && old[old.size()-1-back]->text == texts[texts.size()-1-back])
+		back++;
+
+	size_t old_end = old.size() - back;
+	int begin_address = front < old.size() ? old[front]->address : s->bytes.size();
+	int end_address = old_end < old.size() ? old[old_end]->address : s->bytes.size();
+	std::vector<std::string> removed; // labels that lost a definition
+	for(size_t i = front ; i < old_end ; i++)
+	{
+		for(auto label : old[i]->labels)
+			removed.emplace_back(label);
+		forget_statement(*s , old[i].get());
+	}
+	std::vector<label_info *> moved; // labels whose address may have changed
+
+	std::vector<std::unique_ptr<cached_statement>> fresh;
+	std::vector<unsigned char> bytes;
+	for(size_t i = front ; i < texts.size() - back ; i++)
+	{
+		fresh.emplace_back(new cached_statement);
+		cached_statement *st = fresh.back().get();
+		st->text = texts[i];
+		st->index = i;
+		encode_statement(*st);
+		bytes.insert(bytes.end() , st->bytes.begin() , st->bytes.end());
+		learn_statement(*s , st);
+		moved.insert(moved.end() , st->defined.begin() , st->defined.end());
+	}
+	for(auto &label : removed)
+	{
+		auto it = s->labels.find(label);
+		if(it != s->labels.end())
+			moved.push_back(&it->second);
+	}
+	size_t fresh_count = fresh.size();
+	old.erase(old.begin() + front , old.begin() + old_end);
+	old.insert(old.begin() + front , std::make_move_iterator(fresh.begin()) , std::make_move_iterator(fresh.end()));
+	auto &out = s->bytes;
+	out.erase(out.begin() + begin_address , out.begin() + end_address);
+	out.insert(out.begin() + begin_address , bytes.begin() , bytes.end());
+
+	// statements behind the edit take new line numbers and , if the length changed , new addresses
+	int address = begin_address;
+	bool shifted = (int)bytes.size() != end_address - begin_address;
+	for(size_t i = front ; i < old.size() ; i++)
+	{
+		cached_statement *st = old[i].get();
+		st->index = i;
+		st->address = address;
+		address += st->bytes.size();
+		if(shifted && i >= front + fresh_count)
+			moved.insert(moved.end() , st->defined.begin() , st->defined.end());
+	}
+
+	for(size_t i = front ; i < front + fresh_count ; i++)
+		patch_statement(*s , old[i].get());
+	std::sort(moved.begin() , moved.end());
+	moved.erase(std::unique(moved.begin() , moved.end()) , moved.end());
+	for(label_info *info : moved)
+		for(cached_statement *st : info->uses)
+			patch_statement(*s , st);
+
+	// statements holding an error are encoded again so the error carries the current line number
+	auto &diagnostics = s->result.diagnostics;
+	diagnostics.clear();
+	for(size_t i = 0 ; s->errors > 0 && i < old.size() ; i++)
+		if(!old[i]->error.empty())
+		{
+			if(i < front || i >= front + fresh_count)
+				encode_statement(*old[i]);
+			diagnostics.push_back({ old[i]->error_line , old[i]->error });
+		}
+	for(auto &entry : s->labels)
+	{
+		label_info &info = entry.second;
+		for(size_t k = 1 ; k < info.definitions.size() ; k++)
+			diagnostics.push_back({ info.definitions[k]->index + 1 , "reuse of label " + info.name + " for denoting jump position at line " + std::to_string(info.definitions[k]->index + 1) });
+		if(info.definitions.empty())
+		{
+			int line_no = info.uses[0]->index + 1;
+			for(cached_statement *st : info.uses)
+				line_no = std::min(line_no , st->index + 1);
+			diagnostics.push_back({ line_no , "unresolved label " + info.name + " used at line " + std::to_string(line_no) });
+		}
+	}
+	std::sort(diagnostics.begin() , diagnostics.end() , [](const assembly_diagnostic &a , const assembly_diagnostic &b) { return a.line_no < b.line_no; });
+	s->result.ok = diagnostics.empty();
+	if(s->result.ok)
+		s->result.bytes.assign(s->bytes.begin() , s->bytes.end());
+	else
+		s->result.bytes.clear();
+	return s->result;
+}
+
+/*
+	--serve keeps one process alive for many small jobs. jobs are read from stdin , or from every connection to a
+	unix socket with --socket path , and assembled on a pool of workers.
+========================================================================
+	job      : <id> <start point> <source length>\n<source>
+	response : <id> ok <origin> <hex bytes>\n | <id> err <line> <message>\n
+	responses are written as jobs finish so they can come back out of order , the id tells them apart.
+*/
+struct connection
+{
+	int in , out;
+	bool owned; // the socket is closed once the last response is written
+	std::mutex write_lock;
+	connection(int in , int out , bool owned) : in(in) , out(out) , owned(owned) {}
+	~connection()
+	{
+		if(owned)
+			close(in);
+	}
+};
+
+struct server_job
+{
+	std::string id;
+	std::string start_point;
+	std::string source;
+	std::shared_ptr<connection> client;
+};
+
+struct job_queue
+{
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<server_job> jobs;
+	bool closed = false;
+
+	void push(server_job job)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			jobs.push_back(std::move(job));
+		}
+		ready.notify_one();
+	}
+	// blocks until a job is there , false once the queue is closed and drained
+	bool pop(server_job &job)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		ready.wait(guard , [&]() { return closed || !jobs.empty(); });
+		if(jobs.empty())
+			return false;
+		job = std::move(jobs.front());
+		jobs.pop_front();
+		return true;
+	}
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closed = true;
+		}
+		ready.notify_all();
+	}
+};
+
+void write_all(int fd , const std::string &data)
+{
+	for(size_t done = 0 ; done < data.size() ; )
+	{
+		ssize_t n = write(fd , data.data() + done , data.size() - done);
+		if(n <= 0)
+			return; // the client went away
+		done += n;
+	}
+}
+
+void serve_job(server_job &job)
+{
+	assembly_result result = assemble_source(job.source , job.start_point);
+	std::string response = job.id;
+	if(result.ok)
+	{
+		static const char DIGITS[] = "0123456789ABCDEF";
+		char origin[8];
+		snprintf(origin , sizeof(origin) , "%04X" , result.origin);
+		response += " ok ";
+		response += origin;
+		response += ' ';
+		for(unsigned char b : result.bytes)
+		{
+			response += DIGITS[b >> 4];
+			response += DIGITS[b & 0xF];
+		}
+	}
+	else
+		response += " err " + std::to_string(result.diagnostics[0].line_no) + " " + result.diagnostics[0].message;
+	response += '\n';
+	std::lock_guard<std::mutex> guard(job.client->write_lock);
+	write_all(job.client->out , response);
+}
+
+// reads jobs off a client until it closes , a malformed header drops the client
+void read_jobs(std::shared_ptr<connection> client , job_queue &queue)
+{
+	std::string pending;
+	char block[1 << 16];
+	size_t need = 0; // length of the source of the job being read , 0 while reading a header
+	server_job job;
+	for(;;)
+	{
+		if(need == 0)
+		{
+			size_t eol = pending.find('\n');
+			if(eol != std::string::npos)
+			{
+				std::istringstream header(pending.substr(0 , eol));
+				pending.erase(0 , eol + 1);
+				job = { "" , "" , "" , client };
+				if(!(header >> job.id >> job.start_point >> need))
+					return;
+				if(need == 0)
+					queue.push(job);
+				continue;
+			}
+		}
+		else if(pending.size() >= need)
+		{
+			job.source = pending.substr(0 , need);
+			pending.erase(0 , need);
+			need = 0;
+			queue.push(std::move(job));
+			continue;
+		}
+		ssize_t n = read(client->in , block , sizeof(block));
+		if(n <= 0)
+			return;
+		pending.append(block , n);
+	}
+}
+
+void serve(int threads , std::string socket_path)
+{
+	job_queue queue;
+	std::vector<std::thread> workers;
+	for(int t = 0 ; t < threads ; t++)
+		workers.emplace_back([&]() {
+			server_job job;
+			while(queue.pop(job))
+			{
+				serve_job(job);
+				job = server_job();
+			}
+		});
+
+	if(socket_path == "")
+	{
+		read_jobs(std::make_shared<connection>(STDIN_FILENO , STDOUT_FILENO , false) , queue);
+		queue.close();
+		for(auto &worker : workers)
+			worker.join();
+		return;
+	}
+
+	int listener = socket(AF_UNIX , SOCK_STREAM , 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if(listener < 0 || socket_path.size() >= sizeof(address.sun_path))
+		fail(1 , 0 , "cannot open socket " , socket_path);
+	socket_path.copy(address.sun_path , socket_path.size());
+	unlink(socket_path.c_str());
+	if(bind(listener , (sockaddr *)&address , sizeof(address)) < 0 || listen(listener , 64) < 0)
+		fail(1 , 0 , "cannot listen on " , socket_path);
+	for(;;)
+	{
+		int fd = accept(listener , nullptr , nullptr);
+		if(fd < 0)
+			continue;
+		std::thread(read_jobs , std::make_shared<connection>(fd , fd , true) , std::ref(queue)).detach();
+	}
+}
+
+/*=================================BENCHMARK=========================================*/
+/*
+	--generate writes a synthetic program and --bench times readfile , lex_analyse_source , parse_symbol_table and
+	writeFile on synthetic programs of growing size. the generator is seeded so the same options give the same source.
+	the default mix is the one of test.asm : mostly jumps with MVI , MOV , STA , ADD and NOP in between.
+	with more than one lexer thread every source is also lexed on one thread , as is a copy with errors sprinkled in ,
+	and the tokens , symbols and diagnostics must be the same or the benchmark fails.
+*/
+#define BENCH_FILE "bench.asm"
+#define BENCH_OUTPUT "bench.dat"
+
+enum GEN_KIND { GEN_JMP , GEN_NOP , GEN_MVI , GEN_MOV , GEN_STA , GEN_ADD , GEN_KINDS };
+
+struct generator_options
+{
+	unsigned int seed = 8085;
+	double label_density = 0.25; // fraction of lines carrying a label
+	double forward_ratio = 0.5; // fraction of jumps going to a later label
+	std::array<double , GEN_KINDS> mix = {{4 , 1 , 2 , 1 , 1 , 1}}; // weights of JMP NOP MVI MOV STA ADD
+};
+
+// parses jmp=4,nop=1,... into the mix weights
+void parse_mix(std::string arg , generator_options &opt)
+{
+	static const char *NAMES[GEN_KINDS] = {"jmp" , "nop" , "mvi" , "mov" , "sta" , "add"};
+	size_t pos = 0;
+	while(pos < arg.size())
+	{
+		size_t end = arg.find(',' , pos);
+		if(end == std::string::npos)
+			end = arg.size();
+		std::string item = arg.substr(pos , end - pos);
+		size_t eq = item.find('=');
+		bool found = false;
+		for(int k = 0 ; k < GEN_KINDS && eq != std::string::npos ; k++)
+			if(item.compare(0 , eq , NAMES[k]) == 0)
+			{
+				opt.mix[k] = atof(item.c_str() + eq + 1);
+				found = true;
+			}
+		if(!found)
+		{
+			std::cout<<"err: bad mix entry "<<item<<std::endl;
+			exit(1);
+		}
+		pos = end + 1;
+	}
+}
+
+std::string generate_source(size_t lines , const generator_options &opt)
+{
+	static const char REGS[] = "ABCDEHL";
+	std::mt19937 rng(opt.seed);
+	std::uniform_real_distribution<double> unit(0.0 , 1.0);
+	std::discrete_distribution<int> kind(opt.mix.begin() , opt.mix.end());
+
+	std::vector<size_t> labelled; // lines that carry a label
+	for(size_t i = 0 ; i < lines ; i++)
+		if(unit(rng) < opt.label_density)
+			labelled.push_back(i);
+
+	std::string out;
+	out.reserve(lines * 16);
+	char line[64];
+	size_t next_label = 0; // index in labelled of the first label at or after the current line
+	for(size_t i = 0 ; i < lines ; i++)
+	{
+		while(next_label < labelled.size() && labelled[next_label] < i)
+			next_label++;
+		if(next_label < labelled.size() && labelled[next_label] == i)
+		{
+			snprintf(line , sizeof(line) , "L%zu: " , i);
+			out += line;
+		}
+		int k = kind(rng);
+		if(k == GEN_JMP)
+		{
+			// labels before or on this line are labelled[0 , after) , the rest lie ahead
+			size_t after = next_label < labelled.size() && labelled[next_label] == i ? next_label + 1 : next_label;
+			bool forward = after < labelled.size() && (unit(rng) < opt.forward_ratio || after == 0);
+			if(forward)
+				snprintf(line , sizeof(line) , "JMP L%zu;\n" , labelled[after + rng() % std::min<size_t>(labelled.size() - after , 64)]);
+			else if(after > 0)
+				snprintf(line , sizeof(line) , "JMP L%zu;\n" , labelled[after - 1 - rng() % std::min<size_t>(after , 64)]);
+			else
+				snprintf(line , sizeof(line) , "NOP;\n");
+		}
+		else if(k == GEN_NOP)
+			snprintf(line , sizeof(line) , "NOP;\n");
+		else if(k == GEN_MVI)
+			snprintf(line , sizeof(line) , "MVI %c,%02uH;\n" , REGS[rng() % 7] , (unsigned)(rng() % 100));
+		else if(k == GEN_MOV)
+			snprintf(line , sizeof(line) , "MOV %c,%c;\n" , REGS[rng() % 7] , REGS[rng() % 7]);
+		else if(k == GEN_STA)
+			snprintf(line , sizeof(line) , "STA %04uH;\n" , (unsigned)(8000 + rng() % 2000));
+		else
+			snprintf(line , sizeof(line) , "ADD %c;\n" , REGS[rng() % 7]);
+		out += line;
+	}
+	return out;
+}
+
+void write_text(std::string filename , const std::string &text)
+{
+	std::ofstream output(filename , std::ios::binary);
+	if(!output.write(text.data() , text.size()))
+	{
+		std::cout<<"err: failed to create file "<<filename<<std::endl;
+		exit(1);
+	}
+}
+
+// the source with statements that do not lex inserted at random places
+std::string noisy_source(std::string source , unsigned int seed)
+{
+	static const char *NOISE[] = {" ;" , ";;" , "\"f;x\" " , "@@ ;" , "LBL: " , ":" , "  \n;" , "30H," , "bad:"};
+	std::mt19937 rng(seed);
+	for(size_t i = source.size() / 64 ; i > 0 && !source.empty() ; i--)
+		source.insert(rng() % source.size() , NOISE[rng() % (sizeof(NOISE) / sizeof(NOISE[0]))]);
+	return source;
+}
+
+// the first difference between lexing source on one thread and on threads , empty when there is none
+std::string compare_lexers(std::string_view source , int threads)
+{
+	diagnostic_list e1 , e2;
+	symbol_table a = lex_analyse_source(source , &e1 , 1);
+	symbol_table b = lex_analyse_source(source , &e2 , threads);
+	if(a.size() != b.size())
+		return "token count " + std::to_string(a.size()) + " and " + std::to_string(b.size());
+	for(size_t i = 0 ; i < a.size() ; i++)
+		if(a.tc[i] != b.tc[i] || a.value[i] != b.value[i] || a.line_no[i] != b.line_no[i])
+			return "token " + std::to_string(i) + " at line " + std::to_string(a.line_no[i]);
+	if(a.symbols->names.size() != b.symbols->names.size())
+		return "symbol count " + std::to_string(a.symbols->names.size()) + " and " + std::to_string(b.symbols->names.size());
+	for(size_t i = 0 ; i < a.symbols->names.size() ; i++)
+		if(a.symbols->names[i] != b.symbols->names[i])
+			return "symbol " + a.symbols->names[i] + " and " + b.symbols->names[i];
+	if(e1.size() != e2.size())
+		return "diagnostic count " + std::to_string(e1.size()) + " and " + std::to_string(e2.size());
+	for(size_t i = 0 ; i < e1.size() ; i++)
+		if(e1[i].message != e2[i].message || e1[i].line_no != e2[i].line_no || e1[i].status != e2[i].status)
+			return "diagnostic " + e1[i].message + " and " + e2[i].message;
+	std::string m1 , m2; // without a list the first error is thrown
+	try { lex_analyse_source(source , nullptr , 1); } catch(const assembly_error &e) { m1 = e.message; }
+	try { lex_analyse_source(source , nullptr , threads); } catch(const assembly_error &e) { m2 = e.message; }
+	if(m1 != m2)
+		return "thrown " + m1 + " and " + m2;
+	return "";
+}
+
+void print_phase(const char *phase , double seconds , size_t lines , size_t bytes)
+{
+	char row[160];
+	snprintf(row , sizeof(row) , "%-10s %12zu %14zu %10.4f %14.0f %12.2f" , phase , lines , bytes , seconds ,
+		seconds > 0 ? lines / seconds : 0.0 , seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+	std::cout<<row<<std::endl;
+}
+
+// times every phase of the pipeline over generated sources of the given sizes
+void run_benchmark(const std::vector<size_t> &sizes , const generator_options &opt , int threads)
+{
+	typedef std::chrono::steady_clock clock;
+	char header[160];
+	snprintf(header , sizeof(header) , "%-10s %12s %14s %10s %14s %12s" , "phase" , "lines" , "bytes" , "seconds" , "lines/s" , "MB/s");
+	std::cout<<header<<std::endl;
+	for(size_t lines : sizes)
+	{
+		std::string source = generate_source(lines , opt);
+		write_text(BENCH_FILE , source);
+		char filename[] = BENCH_FILE;
+
+		auto t0 = clock::now();
+		auto b = readfile(filename);
+		auto t1 = clock::now();
+		auto st = lex_analyse_source(b.view() , nullptr , threads);
+		auto t2 = clock::now();
+		auto ts = parse_symbol_table(st , "8000");
+		auto t3 = clock::now();
+		write_output(ts , BENCH_OUTPUT , OUT_DAT);
+		auto t4 = clock::now();
+
+		auto seconds = [](clock::time_point a , clock::time_point b) { return std::chrono::duration<double>(b - a).count(); };
+		print_phase("readfile" , seconds(t0 , t1) , lines , b.size);
+		print_phase("lex" , seconds(t1 , t2) , lines , b.size);
+		print_phase("parse" , seconds(t2 , t3) , lines , b.size);
+		struct stat written;
+		print_phase("writeFile" , seconds(t3 , t4) , lines , stat(BENCH_OUTPUT , &written) == 0 ? written.st_size : 0);
+		print_phase("total" , seconds(t0 , t4) , lines , b.size);
+		if(threads > 1)
+			for(const std::string &checked : { source , noisy_source(source , opt.seed) })
+			{
+				std::string difference = compare_lexers(checked , threads);
+				if(!difference.empty())
+				{
+					std::cout<<"err: the lexer on "<<threads<<" threads differs from one thread : "<<difference<<std::endl;
+					remove(BENCH_FILE);
+					remove(BENCH_OUTPUT);
+					exit(1);
+				}
+			}
+		std::cout<<std::endl;
+	}
+	remove(BENCH_FILE);
+	remove(BENCH_OUTPUT);
+	exit(0);
+}
+
+// --bench [--lines n,n,..] and --generate n -o file share the generator options
+void bench_main(int argc , char *argv[])
+{
+	generator_options opt;
+	std::vector<size_t> sizes = {1000 , 10000 , 100000 , 1000000};
+	std::string output_file = "generated.asm";
+	int threads = std::max(1u , std::thread::hardware_concurrency()); // of the lexer
+	for(int i = 2 ; i < argc ; i++)
+	{
+		std::string arg = argv[i];
+		if(arg == "--lines" && i+1 < argc)
+		{
+			sizes.clear();
+			for(char *p = argv[++i] ; *p ; )
+			{
+				sizes.push_back(strtoull(p , &p , 10));
+				if(*p == ',')
+					p++;
+				else if(*p)
+					break;
+			}
+		}
+		else if(arg == "--seed" && i+1 < argc)
+			opt.seed = strtoul(argv[++i] , nullptr , 10);
+		else if(arg == "--label-density" && i+1 < argc)
+			opt.label_density = atof(argv[++i]);
+		else if(arg == "--forward" && i+1 < argc)
+			opt.forward_ratio = atof(argv[++i]);
+		else if(arg == "--mix" && i+1 < argc)
+			parse_mix(argv[++i] , opt);
+		else if(arg == "-o" && i+1 < argc)
+			output_file = argv[++i];
+		else if(arg == "-j" && i+1 < argc)
+			threads = std::max(1 , atoi(argv[++i]));
+		else if(std::string(argv[1]) == "--generate" && isdigit(arg[0]))
+			sizes = { strtoull(arg.c_str() , nullptr , 10) };
+		else
+		{
+			std::cout<<"err: unknown option "<<arg<<std::endl;
+			exit(1);
+		}
+	}
+	if(std::string(argv[1]) == "--generate")
+	{
+		write_text(output_file , generate_source(sizes[0] , opt));
+		exit(0);
+	}
+	run_benchmark(sizes , opt , threads);
+}
+
+
+
+
+#ifndef ASSEMBLER_LIBRARY
+void run_command_line(int argc  , char *argv[])
+{
+	if(argc < 2)
+		std::cout<<"err: No file given"<<std::endl;
+	else if(std::string(argv[1]) == "--bench" || std::string(argv[1]) == "--generate")
+		bench_main(argc , argv);
+	else if(std::string(argv[1]) == "--batch" && argc > 2)
+	{
+		int threads = std::max(1u , std::thread::hardware_concurrency());
+		bool use_cache = true;
+		for(int i = 3 ; i < argc ; i++)
+			if(std::string(argv[i]) == "-j" && i + 1 < argc)
+				threads = std::max(1 , atoi(argv[++i]));
+			else if(std::string(argv[i]) == "--no-cache")
+				use_cache = false;
+		run_batch(argv[2] , threads , use_cache);
+	}
+	else if(std::string(argv[1]) == "--serve")
+	{
+		int threads = std::max(1u , std::thread::hardware_concurrency());
+		std::string socket_path = "";
+		for(int i = 2 ; i + 1 < argc ; i += 2)
+			if(std::string(argv[i]) == "-j")
+				threads = std::max(1 , atoi(argv[i+1]));
+			else if(std::string(argv[i]) == "--socket")
+				socket_path = argv[i+1];
+		serve(threads , socket_path);
+	}
+	else
+		{
+			std::string start_point="8000";
+			OUTPUT_FORMAT format = OUT_DAT;
+			std::string output_file = "";
+			bool stream = false;
+			bool compile_only = false;
+			bool run = false;
+			bool use_cache = true;
+			bool stats = false;
+			bool optimize = false;
+			bool cfg = false;
+			std::string profile = ""; // name of the listing and folded stacks
+			std::vector<device> devices; // on the bus of --run
+			std::string record = "" , replay = ""; // input logs of the devices
+			std::string source; // kept for the listing
+			std::string cache_dir = "";
+			unsigned long long cache_limit = DEFAULT_CACHE_MB << 20;
+			unsigned long long max_cycles = DEFAULT_MAX_CYCLES;
+			int threads = std::max(1u , std::thread::hardware_concurrency());
+			std::vector<char *> inputs = { argv[1] };
+			for(int i = 2 ; i < argc ; i++)
+			{
+				std::string arg = argv[i];
+				if(arg == "--bin")
+					format = OUT_BIN;
+				else if(arg == "--hex")
+					format = OUT_HEX;
+				else if(arg == "--dat")
+					format = OUT_DAT;
+				else if(arg == "--stream")
+					stream = true;
+				else if(arg == "-o" && i+1 < argc)
+					output_file = argv[++i];
+				else if(arg == "-c")
+					compile_only = true;
+				else if(arg == "--run")
+					run = true;
+				else if(arg == "--no-cache")
+					use_cache = false;
+				else if(arg == "--stats")
+					stats = true;
+				else if(arg == "-O")
+					optimize = true;
+				else if(arg == "--cfg")
+					cfg = true;
+				else if(arg == "--profile" && i+1 < argc)
+					profile = argv[++i];
+				else if(arg == "--device" && i+1 < argc)
+					devices.push_back(parse_device(argv[++i]));
+				else if(arg == "--record" && i+1 < argc)
+					record = argv[++i];
+				else if(arg == "--replay" && i+1 < argc)
+					replay = argv[++i];
+				else if(arg == "--cache" && i+1 < argc)
+					cache_dir = argv[++i];
+				else if(arg == "--cache-size" && i+1 < argc)
+				{
+					if(!parse_count(argv[++i] , cache_limit) || cache_limit > (~0ULL >> 20))
+						fail(1 , 0 , "bad value " , argv[i] , " of --cache-size");
+					cache_limit <<= 20;
+				}
+				else if(arg == "--max-cycles" && i+1 < argc)
+				{
+					if(!parse_count(argv[++i] , max_cycles))
+						fail(1 , 0 , "bad value " , argv[i] , " of --max-cycles");
+				}
+				else if(arg == "-j" && i+1 < argc)
+					threads = std::max(1 , atoi(argv[++i]));
+				else if(is_start_point(arg))
+					start_point = arg;
+				else
+					inputs.push_back(argv[i]);
+			}
+			if(stats)
+			{
+				STATS.enabled = true;
+				atexit(print_stats);
+			}
+			include_cache includes; // every included file is lexed once for all inputs
+			if(compile_only) // every source becomes an object file next to it
+			{
+				stats_phase("assemble");
+				parallel_for(inputs.size() , threads , [&](int i) {
+					write_object(assemble_object(inputs[i] , includes) , object_file_name(inputs[i]));
+				});
+				return;
+			}
+			if(output_file == "" && !cfg) // --cfg prints to stdout unless -o is given
+				output_file = format == OUT_BIN ? "a.bin" : format == OUT_HEX ? "a.hex" : "a.dat";
+			if(optimize && (stream || compile_only || inputs.size() > 1 || is_object_file(inputs[0])))
+				fail(1 , 0 , "-O works on a single source without --stream");
+			if(profile != "" && (stream || compile_only || inputs.size() > 1 || is_object_file(inputs[0])))
+				fail(1 , 0 , "--profile works on a single source without --stream");
+			if(stream)
+			{
+				stats_phase("stream");
+				stream_assemble(argv[1] , start_point , output_file , format);
+				return;
+			}
+			binarySource ts;
+			program_map map; // labels and lines for --cfg and --profile
+			if(inputs.size() > 1 || is_object_file(inputs[0]))
+			{
+				stats_phase("assemble");
+				auto objects = load_objects(inputs , threads , includes);
+				stats_phase("link");
+				ts = link_objects(objects , start_point);
+			}
+			else
+			{
+				stats_phase("read");
+				auto b = readfile(argv[1]);
+				std::string key;
+				if(b.view().find("INCLUDE") != std::string_view::npos || cfg || profile != "") // the key does not cover included files , nor is the map cached
+					cache_dir = "";
+				if(cache_dir != "" && assembler_version().empty())
+					cache_dir = "";
+				if(profile != "")
+					source = b.view();
+				if(cache_dir != "")
+				{
+					stats_phase("cache");
+					key = cache_key(b.view() , optimize ? start_point + " -O" : start_point);
+				}
+				if(cache_dir == "" || !cache_load(cache_dir , key , ts))
+				{
+					stats_phase("lex");
+					diagnostic_list errors;
+					auto st = lex_analyse_source(b.view() , &errors , threads);
+					if(has_directives(st))
+					{
+						check_diagnostics(&errors);
+						stats_phase("preprocess");
+						st = preprocess_source(st , includes , directory_of(argv[1]));
+					}
+					stats_phase("parse");
+					ts = parse_symbol_table(st , start_point , &errors , optimize , cfg || profile != "" ? &map : nullptr);
+					if(cache_dir != "")
+					{
+						stats_phase("cache");
+						cache_store(cache_dir , key , ts , cache_limit);
+					}
+				}
+			}
+			if(cfg)
+			{
+				stats_phase("cfg");
+				control_flow_graph g = build_cfg(ts);
+				if(output_file == "")
+					write_cfg_json(g , ts , map , std::cout);
+				else
+				{
+					std::ofstream out(output_file);
+					write_cfg_json(g , ts , map , out);
+				}
+				return;
+			}
+			if(profile != "")
+			{
+				stats_phase("profile");
+				profile_program(ts , map , source , max_cycles , profile);
+			}
+			if(run)
+			{
+				stats_phase("run");
+				run_program(ts , max_cycles , use_cache , devices , record , replay);
+			}
+			stats_phase("write");
+			writeFile(ts , output_file , format);
+		}
+}
+
+int main(int argc  , char *argv[])
+{
+	try
+	{
+		run_command_line(argc , argv);
+	}
+	catch(const assembly_error &e)
+	{
+		std::cout<<std::endl<<"err: "<<e.message<<std::endl;
+		return std::max(e.status , 1); // a failed assembly never exits 0
+	}
+	catch(const assembly_errors &e)
+	{
+		std::cout<<std::endl;
+		int status = 1;
+		for(auto &error : e.list)
+		{
+			std::cout<<"err: "<<error.message<<std::endl;
+			status = std::max(status , error.status);
+		}
+		return status;
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,362 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <array>
+#include <string_view>
+
+/*
+	Opcode tables for the whole 8085 instruction set.
+
+	MNEMONIC_LIST holds one entry per mnemonic with the shape of its operands, the base opcode and
+	how the operands are folded into the base opcode. OPCODE_TABLE is generated from it at compile
+	time and holds one entry for each of the 256 opcodes (246 of them are defined by the 8085).
+
+	mnemonics are looked up through a perfect hash whose seed is searched at compile time, so
+	find_mnemonic() is one hash and one compare with no allocation.
+========================================================================
+	register codes  : B=0 C=1 D=2 E=3 H=4 L=5 M=6 A=7
+	pair codes      : B=0 D=1 H=2 SP=3 (PSW=3 for PUSH and POP)
+*/
+
+enum OPERAND_SHAPE
+{
+	OPS_NONE ,      // NOP;
+	OPS_REG ,       // ADD B; | INR M;
+	OPS_REG_REG ,   // MOV A,B;
+	OPS_REG_DATA ,  // MVI A,30H;
+	OPS_DATA ,      // ADI 30H;
+	OPS_ADDR ,      // JMP 8000H; | JMP LABEL;
+	OPS_PAIR ,      // PUSH B; | INX SP;
+	OPS_PAIR_ADDR , // LXI H,8000H; | LXI H,LABEL;
+	OPS_RST         // RST 7;
+};
+
+// how the operands are folded into the base opcode
+enum OPERAND_FIELD
+{
+	F_NONE ,
+	F_DST ,      // base | r<<3
+	F_SRC ,      // base | r
+	F_DST_SRC ,  // base | r1<<3 | r2
+	F_PAIR_SP ,  // base | rp<<4 with rp in B,D,H,SP
+	F_PAIR_PSW , // base | rp<<4 with rp in B,D,H,PSW
+	F_PAIR_BD ,  // base | rp<<4 with rp in B,D
+	F_RST        // base | n<<3
+};
+
+/*
+	t_min/t_max are the T-states of the instruction.
+	for register operands t_min is the cost with a register and t_max the cost when M is used.
+	for conditional jumps, calls and returns t_min is the not taken cost and t_max the taken cost.
+*/
+struct mnemonic_def
+{
+	std::string_view name;
+	OPERAND_SHAPE shape;
+	unsigned char base;
+	OPERAND_FIELD field;
+	unsigned char t_min;
+	unsigned char t_max;
+};
+
+#define MNEMONIC_COUNT 80
+#define NO_MNEMONIC 0xFF
+
+constexpr std::array<mnemonic_def , MNEMONIC_COUNT> MNEMONIC_LIST = {{
+	// no operands
+	{"NOP" , OPS_NONE , 0x00 , F_NONE , 4 , 4},
+	{"HLT" , OPS_NONE , 0x76 , F_NONE , 5 , 5},
+	{"RLC" , OPS_NONE , 0x07 , F_NONE , 4 , 4},
+	{"RRC" , OPS_NONE , 0x0F , F_NONE , 4 , 4},
+	{"RAL" , OPS_NONE , 0x17 , F_NONE , 4 , 4},
+	{"RAR" , OPS_NONE , 0x1F , F_NONE , 4 , 4},
+	{"RIM" , OPS_NONE , 0x20 , F_NONE , 4 , 4},
+	{"SIM" , OPS_NONE , 0x30 , F_NONE , 4 , 4},
+	{"DAA" , OPS_NONE , 0x27 , F_NONE , 4 , 4},
+	{"CMA" , OPS_NONE , 0x2F , F_NONE , 4 , 4},
+	{"STC" , OPS_NONE , 0x37 , F_NONE , 4 , 4},
+	{"CMC" , OPS_NONE , 0x3F , F_NONE , 4 , 4},
+	{"XCHG" , OPS_NONE , 0xEB , F_NONE , 4 , 4},
+	{"XTHL" , OPS_NONE , 0xE3 , F_NONE , 16 , 16},
+	{"SPHL" , OPS_NONE , 0xF9 , F_NONE , 6 , 6},
+	{"PCHL" , OPS_NONE , 0xE9 , F_NONE , 6 , 6},
+	{"DI" , OPS_NONE , 0xF3 , F_NONE , 4 , 4},
+	{"EI" , OPS_NONE , 0xFB , F_NONE , 4 , 4},
+	{"RET" , OPS_NONE , 0xC9 , F_NONE , 10 , 10},
+	{"RNZ" , OPS_NONE , 0xC0 , F_NONE , 6 , 12},
+	{"RZ" , OPS_NONE , 0xC8 , F_NONE , 6 , 12},
+	{"RNC" , OPS_NONE , 0xD0 , F_NONE , 6 , 12},
+	{"RC" , OPS_NONE , 0xD8 , F_NONE , 6 , 12},
+	{"RPO" , OPS_NONE , 0xE0 , F_NONE , 6 , 12},
+	{"RPE" , OPS_NONE , 0xE8 , F_NONE , 6 , 12},
+	{"RP" , OPS_NONE , 0xF0 , F_NONE , 6 , 12},
+	{"RM" , OPS_NONE , 0xF8 , F_NONE , 6 , 12},
+	// one register
+	{"ADD" , OPS_REG , 0x80 , F_SRC , 4 , 7},
+	{"ADC" , OPS_REG , 0x88 , F_SRC , 4 , 7},
+	{"SUB" , OPS_REG , 0x90 , F_SRC , 4 , 7},
+	{"SBB" , OPS_REG , 0x98 , F_SRC , 4 , 7},
+	{"ANA" , OPS_REG , 0xA0 , F_SRC , 4 , 7},
+	{"XRA" , OPS_REG , 0xA8 , F_SRC , 4 , 7},
+	{"ORA" , OPS_REG , 0xB0 , F_SRC , 4 , 7},
+	{"CMP" , OPS_REG , 0xB8 , F_SRC , 4 , 7},
+	{"INR" , OPS_REG , 0x04 , F_DST , 4 , 10},
+	{"DCR" , OPS_REG , 0x05 , F_DST , 4 , 10},
+	// two registers
+	{"MOV" , OPS_REG_REG , 0x40 , F_DST_SRC , 4 , 7},
+	// register and data
+	{"MVI" , OPS_REG_DATA , 0x06 , F_DST , 7 , 10},
+	// data
+	{"ADI" , OPS_DATA , 0xC6 , F_NONE , 7 , 7},
+	{"ACI" , OPS_DATA , 0xCE , F_NONE , 7 , 7},
+	{"SUI" , OPS_DATA , 0xD6 , F_NONE , 7 , 7},
+	{"SBI" , OPS_DATA , 0xDE , F_NONE , 7 , 7},
+	{"ANI" , OPS_DATA , 0xE6 , F_NONE , 7 , 7},
+	{"XRI" , OPS_DATA , 0xEE , F_NONE , 7 , 7},
+	{"ORI" , OPS_DATA , 0xF6 , F_NONE , 7 , 7},
+	{"CPI" , OPS_DATA , 0xFE , F_NONE , 7 , 7},
+	{"IN" , OPS_DATA , 0xDB , F_NONE , 10 , 10},
+	{"OUT" , OPS_DATA , 0xD3 , F_NONE , 10 , 10},
+	// address
+	{"JMP" , OPS_ADDR , 0xC3 , F_NONE , 10 , 10},
+	{"JNZ" , OPS_ADDR , 0xC2 , F_NONE , 7 , 10},
+	{"JZ" , OPS_ADDR , 0xCA , F_NONE , 7 , 10},
+	{"JNC" , OPS_ADDR , 0xD2 , F_NONE , 7 , 10},
+	{"JC" , OPS_ADDR , 0xDA , F_NONE , 7 , 10},
+	{"JPO" , OPS_ADDR , 0xE2 , F_NONE , 7 , 10},
+	{"JPE" , OPS_ADDR , 0xEA , F_NONE , 7 , 10},
+	{"JP" , OPS_ADDR , 0xF2 , F_NONE , 7 , 10},
+	{"JM" , OPS_ADDR , 0xFA , F_NONE , 7 , 10},
+	{"CALL" , OPS_ADDR , 0xCD , F_NONE , 18 , 18},
+	{"CNZ" , OPS_ADDR , 0xC4 , F_NONE , 9 , 18},
+	{"CZ" , OPS_ADDR , 0xCC , F_NONE , 9 , 18},
+	{"CNC" , OPS_ADDR , 0xD4 , F_NONE , 9 , 18},
+	{"CC" , OPS_ADDR , 0xDC , F_NONE , 9 , 18},
+	{"CPO" , OPS_ADDR , 0xE4 , F_NONE , 9 , 18},
+	{"CPE" , OPS_ADDR , 0xEC , F_NONE , 9 , 18},
+	{"CP" , OPS_ADDR , 0xF4 , F_NONE , 9 , 18},
+	{"CM" , OPS_ADDR , 0xFC , F_NONE , 9 , 18},
+	{"LDA" , OPS_ADDR , 0x3A , F_NONE , 13 , 13},
+	{"STA" , OPS_ADDR , 0x32 , F_NONE , 13 , 13},
+	{"LHLD" , OPS_ADDR , 0x2A , F_NONE , 16 , 16},
+	{"SHLD" , OPS_ADDR , 0x22 , F_NONE , 16 , 16},
+	// register pair
+	{"PUSH" , OPS_PAIR , 0xC5 , F_PAIR_PSW , 12 , 12},
+	{"POP" , OPS_PAIR , 0xC1 , F_PAIR_PSW , 10 , 10},
+	{"DAD" , OPS_PAIR , 0x09 , F_PAIR_SP , 10 , 10},
+	{"INX" , OPS_PAIR , 0x03 , F_PAIR_SP , 6 , 6},
+	{"DCX" , OPS_PAIR , 0x0B , F_PAIR_SP , 6 , 6},
+	{"LDAX" , OPS_PAIR , 0x0A , F_PAIR_BD , 7 , 7},
+	{"STAX" , OPS_PAIR , 0x02 , F_PAIR_BD , 7 , 7},
+	// register pair and address
+	{"LXI" , OPS_PAIR_ADDR , 0x01 , F_PAIR_SP , 10 , 10},
+	// restart
+	{"RST" , OPS_RST , 0xC7 , F_RST , 12 , 12}
+}};
+
+constexpr unsigned char shape_length(OPERAND_SHAPE shape)
+{
+	switch(shape)
+	{
+		case OPS_REG_DATA :
+		case OPS_DATA :
+			return 2;
+		case OPS_ADDR :
+		case OPS_PAIR_ADDR :
+			return 3;
+		default :
+			return 1;
+	}
+}
+
+// number of operand values the field can take , the opcode of value v is base | v<<shift
+constexpr int field_values(OPERAND_FIELD field)
+{
+	switch(field)
+	{
+		case F_DST : case F_SRC : case F_RST : return 8;
+		case F_DST_SRC : return 64;
+		case F_PAIR_SP : case F_PAIR_PSW : return 4;
+		case F_PAIR_BD : return 2;
+		default : return 1;
+	}
+}
+
+constexpr int field_shift(OPERAND_FIELD field)
+{
+	switch(field)
+	{
+		case F_DST : case F_RST : return 3;
+		case F_PAIR_SP : case F_PAIR_PSW : case F_PAIR_BD : return 4;
+		default : return 0;
+	}
+}
+
+/*=================================OPCODE TABLE===================================*/
+struct opcode_def
+{
+	unsigned char mnemonic; // index in MNEMONIC_LIST or NO_MNEMONIC for the 10 undefined opcodes
+	unsigned char length;
+	unsigned char t_min;
+	unsigned char t_max;
+};
+
+// true when one of the register operands of the given opcode is M
+constexpr bool uses_memory_operand(OPERAND_FIELD field , int value)
+{
+	if(field == F_DST || field == F_SRC)
+		return value == 6;
+	if(field == F_DST_SRC)
+		return (value>>3) == 6 || (value & 7) == 6;
+	return false;
+}
+
+constexpr std::array<opcode_def , 256> build_opcode_table()
+{
+	std::array<opcode_def , 256> table{};
+	for(int i = 0 ; i < 256 ; i++)
+		table[i] = {NO_MNEMONIC , 0 , 0 , 0};
+
+	for(int m = 0 ; m < MNEMONIC_COUNT ; m++)
+	{
+		const mnemonic_def &d = MNEMONIC_LIST[m];
+		for(int v = 0 ; v < field_values(d.field) ; v++)
+		{
+			if(d.field == F_DST_SRC && v == (6<<3 | 6)) // MOV M,M is HLT
+				continue;
+			int code = d.base | (v << field_shift(d.field));
+			bool reg_timing = d.field == F_DST || d.field == F_SRC || d.field == F_DST_SRC;
+			unsigned char t_min = d.t_min , t_max = d.t_max;
+			if(reg_timing)
+				t_min = t_max = uses_memory_operand(d.field , v) ? d.t_max : d.t_min;
+			table[code] = {static_cast<unsigned char>(m) , shape_length(d.shape) , t_min , t_max};
+		}
+	}
+	return table;
+}
+
+constexpr std::array<opcode_def , 256> OPCODE_TABLE = build_opcode_table();
+
+constexpr int count_defined_opcodes()
+{
+	int n = 0;
+	for(int i = 0 ; i < 256 ; i++)
+		if(OPCODE_TABLE[i].mnemonic != NO_MNEMONIC)
+			n++;
+	return n;
+}
+
+static_assert(count_defined_opcodes() == 246 , "the 8085 defines 246 opcodes");
+
+/*=================================PERFECT HASH===================================*/
+#define MNEMONIC_HASH_SIZE 1024
+
+constexpr unsigned mnemonic_hash(std::string_view s , unsigned seed)
+{
+	unsigned h = seed;
+	for(char c : s)
+		h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+	return (h ^ (h >> 15)) & (MNEMONIC_HASH_SIZE - 1);
+}
+
+constexpr bool is_perfect_seed(unsigned seed)
+{
+	bool used[MNEMONIC_HASH_SIZE] = {};
+	for(int m = 0 ; m < MNEMONIC_COUNT ; m++)
+	{
+		unsigned slot = mnemonic_hash(MNEMONIC_LIST[m].name , seed);
+		if(used[slot])
+			return false;
+		used[slot] = true;
+	}
+	return true;
+}
+
+constexpr unsigned find_perfect_seed()
+{
+	for(unsigned seed = 2166136261u ; seed < 2166136261u + 4096 ; seed++)
+		if(is_perfect_seed(seed))
+			return seed;
+	return 0;
+}
+
+constexpr unsigned MNEMONIC_SEED = find_perfect_seed();
+static_assert(MNEMONIC_SEED != 0 , "no perfect hash seed found for the mnemonic list");
+
+constexpr std::array<unsigned char , MNEMONIC_HASH_SIZE> build_mnemonic_slots()
+{
+	std::array<unsigned char , MNEMONIC_HASH_SIZE> slots{};
+	for(int i = 0 ; i < MNEMONIC_HASH_SIZE ; i++)
+		slots[i] = NO_MNEMONIC;
+	for(int m = 0 ; m < MNEMONIC_COUNT ; m++)
+		slots[mnemonic_hash(MNEMONIC_LIST[m].name , MNEMONIC_SEED)] = static_cast<unsigned char>(m);
+	return slots;
+}
+
+constexpr std::array<unsigned char , MNEMONIC_HASH_SIZE> MNEMONIC_SLOTS = build_mnemonic_slots();
+
+// index of the mnemonic in MNEMONIC_LIST or -1 if the lexem is not a mnemonic
+constexpr int find_mnemonic(std::string_view lexem)
+{
+	if(lexem.size() < 2 || lexem.size() > 4)
+		return -1;
+	unsigned char m = MNEMONIC_SLOTS[mnemonic_hash(lexem , MNEMONIC_SEED)];
+	if(m == NO_MNEMONIC || MNEMONIC_LIST[m].name != lexem)
+		return -1;
+	return m;
+}
+
+static_assert(find_mnemonic("MOV") >= 0 && find_mnemonic("MOVE") < 0 , "mnemonic hash is broken");
+
+/*=================================REGISTERS======================================*/
+
+// register code B=0 C=1 D=2 E=3 H=4 L=5 M=6 A=7 or -1
+constexpr int register_code(std::string_view r)
+{
+	if(r.size() != 1)
+		return -1;
+	switch(r[0])
+	{
+		case 'B' : return 0;
+		case 'C' : return 1;
+		case 'D' : return 2;
+		case 'E' : return 3;
+		case 'H' : return 4;
+		case 'L' : return 5;
+		case 'M' : return 6;
+		case 'A' : return 7;
+		default : return -1;
+	}
+}
+
+// register operands as numbers , the registers by their code and the two pair only names after them
+#define REGISTER_SP 8
+#define REGISTER_PSW 9
+constexpr std::string_view REGISTER_NAMES[10] = {"B" , "C" , "D" , "E" , "H" , "L" , "M" , "A" , "SP" , "PSW"};
+
+constexpr int register_operand(std::string_view r)
+{
+	if(r == "SP")
+		return REGISTER_SP;
+	if(r == "PSW")
+		return REGISTER_PSW;
+	return register_code(r);
+}
+
+// register pair code for the given field or -1 if the pair is not allowed there
+constexpr int pair_code(std::string_view r , OPERAND_FIELD field)
+{
+	if(r == "B")
+		return 0;
+	if(r == "D")
+		return 1;
+	if(r == "H" && field != F_PAIR_BD)
+		return 2;
+	if(r == "SP" && field == F_PAIR_SP)
+		return 3;
+	if(r == "PSW" && field == F_PAIR_PSW)
+		return 3;
+	return -1;
+}
+
+#endif
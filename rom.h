@@ -0,0 +1,300 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "opcodes.h"
+
+/*
+	compile time assembler for small routines embedded in C++ programs.
+
+		constexpr auto DELAY = ROM_8085(0x8000 , "MVI B,10H; LP: DCR B; JNZ LP; RET;");
+
+	DELAY is a std::array<uint8_t , N> holding the assembled bytes for the given origin. the source takes the
+	grammar of the assembler (statements end with ';' , labels with ':' , 30H is data , 8000H an address and
+	a label can stand for an address) and is encoded with MNEMONIC_LIST of opcodes.h.
+	the source is read twice , once to place the labels and size the image and once to encode it. an error stops
+	the compilation in rom_error_at<LINE , ERROR> , the line and the error are its template arguments.
+	lines are numbered like the assembler numbers them , by statement and not by '\n' : every ';' right after a word
+	starts the next line , a ';' after a space , ',' , ':' or ';' does not.
+========================================================================
+	header only , it needs nothing of main.cc
+*/
+
+#define ROM_MAX_LABELS 256
+
+enum rom_error
+{
+	ROM_OK ,
+	ROM_UNKNOWN_MNEMONIC ,
+	ROM_BAD_OPERANDS ,       // the operands do not fit the mnemonic
+	ROM_BAD_RESTART ,        // RST takes 0-7
+	ROM_MOV_M_M ,            // not part of the architecture
+	ROM_MISSING_SEMICOLON ,
+	ROM_UNDEFINED_LABEL ,
+	ROM_DUPLICATE_LABEL ,
+	ROM_BAD_LABEL ,          // a register , a mnemonic or not a name
+	ROM_TOO_MANY_LABELS ,
+	ROM_TOO_LONG             // runs past FFFF
+};
+
+struct rom_scan
+{
+	rom_error error = ROM_OK;
+	int line = 0; // where the error is , counted in statements like the assembler
+	size_t size = 0; // bytes of the image
+};
+
+struct rom_label
+{
+	std::string_view name;
+	unsigned address;
+};
+
+// is_delimiter of the lexer
+constexpr bool rom_is_delimiter(char c)
+{
+	return (unsigned char)c <= ' ' || (unsigned char)c > 126 || c == ',' || c == ';' || c == ':';
+}
+
+// the word , ':' , ',' or ';' at pos , an empty view at the end. the other delimiters of the lexer (control
+// bytes , space and bytes above 126) are skipped. line goes on at a ';' ending a word
+constexpr std::string_view rom_next(std::string_view source , size_t &pos , int &line)
+{
+	while(pos < source.size() && rom_is_delimiter(source[pos]) && source[pos] != ':' && source[pos] != ',' && source[pos] != ';')
+		pos++;
+	size_t start = pos;
+	if(pos < source.size() && (source[pos] == ':' || source[pos] == ',' || source[pos] == ';'))
+	{
+		if(source[pos] == ';' && pos > 0 && !rom_is_delimiter(source[pos - 1]))
+			line++;
+		return source.substr(pos++ , 1);
+	}
+	while(pos < source.size() && !rom_is_delimiter(source[pos]))
+		pos++;
+	return source.substr(start , pos - start);
+}
+
+constexpr bool rom_is_digit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool rom_is_hex(char c) { return rom_is_digit(c) || (c >= 'A' && c <= 'F'); }
+constexpr int rom_hex(char c) { return rom_is_digit(c) ? c - '0' : c - 'A' + 10; }
+
+// 5 , 30H , 0FFH , 8000H or 0FFFFH like the lexer of the assembler , -1 for anything else
+constexpr int rom_number(std::string_view word , bool address)
+{
+	if(!address && word.size() == 1 && rom_is_digit(word[0]))
+		return word[0] - '0';
+	size_t digits = word.size() - 1;
+	if(word.size() >= 3 && digits % 2 == 1 && word[0] == '0')
+		digits--;
+	if(word.size() < 3 || digits != (address ? 4u : 2u) || !rom_is_digit(word[0]) || word.back() != 'H')
+		return -1;
+	int value = 0;
+	for(size_t i = 0 ; i + 1 < word.size() ; i++)
+	{
+		if(!rom_is_hex(word[i]))
+			return -1;
+		value = value << 4 | rom_hex(word[i]);
+	}
+	return value;
+}
+
+constexpr bool rom_is_label(std::string_view word)
+{
+	if(word.empty() || !(word[0] == '_' || (word[0] >= 'A' && word[0] <= 'Z') || (word[0] >= 'a' && word[0] <= 'z')))
+		return false;
+	for(char c : word)
+		if(!(c == '_' || c == '-' || rom_is_digit(c) || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')))
+			return false;
+	return true;
+}
+
+// the address of an 8000H operand or a label , -1 when the label is not known (yet) , -2 when it is neither
+constexpr int rom_address(std::string_view word , const rom_label *labels , int count)
+{
+	int value = rom_number(word , true);
+	if(value >= 0)
+		return value;
+	if(!rom_is_label(word) || register_operand(word) >= 0 || find_mnemonic(word) >= 0)
+		return -2;
+	for(int i = 0 ; i < count ; i++)
+		if(labels[i].name == word)
+			return labels[i].address;
+	return -1;
+}
+
+// encodes one statement into out (when not nullptr) , the operands are already split
+constexpr rom_error rom_encode(const mnemonic_def &d , const std::string_view *ops , int count , const rom_label *labels ,
+	int label_count , bool resolve , uint8_t *out)
+{
+	int needed = d.shape == OPS_NONE ? 0 : (d.shape == OPS_REG_REG || d.shape == OPS_REG_DATA || d.shape == OPS_PAIR_ADDR ? 2 : 1);
+	if(count != needed)
+		return ROM_BAD_OPERANDS;
+	int opcode = d.base , data = -1 , address = 0;
+	switch(d.shape)
+	{
+		case OPS_REG :
+		case OPS_REG_DATA : {
+			int r = register_code(ops[0]);
+			if(r < 0)
+				return ROM_BAD_OPERANDS;
+			opcode |= r << field_shift(d.field);
+			if(d.shape == OPS_REG_DATA && (data = rom_number(ops[1] , false)) < 0)
+				return ROM_BAD_OPERANDS;
+			break;
+		}
+		case OPS_REG_REG : {
+			int r1 = register_code(ops[0]) , r2 = register_code(ops[1]);
+			if(r1 < 0 || r2 < 0)
+				return ROM_BAD_OPERANDS;
+			if(r1 == 6 && r2 == 6)
+				return ROM_MOV_M_M;
+			opcode |= r1 << 3 | r2;
+			break;
+		}
+		case OPS_DATA :
+			if((data = rom_number(ops[0] , false)) < 0)
+				return ROM_BAD_OPERANDS;
+			break;
+		case OPS_RST : {
+			int n = rom_number(ops[0] , false);
+			if(n < 0)
+				return ROM_BAD_OPERANDS;
+			if(n > 7)
+				return ROM_BAD_RESTART;
+			opcode |= n << 3;
+			break;
+		}
+		case OPS_PAIR :
+		case OPS_PAIR_ADDR : {
+			int rp = pair_code(ops[0] , d.field);
+			if(rp < 0)
+				return ROM_BAD_OPERANDS;
+			opcode |= rp << 4;
+			if(d.shape == OPS_PAIR)
+				break;
+			address = rom_address(ops[1] , labels , label_count);
+			break;
+		}
+		case OPS_ADDR :
+			address = rom_address(ops[0] , labels , label_count);
+			break;
+		default :
+			break;
+	}
+	if(address == -2)
+		return ROM_BAD_OPERANDS;
+	if(address == -1 && resolve) // labels ahead are not known in the first pass
+		return ROM_UNDEFINED_LABEL;
+	if(out != nullptr)
+	{
+		out[0] = opcode;
+		if(data >= 0)
+			out[1] = data;
+		if(shape_length(d.shape) == 3)
+		{
+			out[1] = address & 0xFF;
+			out[2] = address >> 8;
+		}
+	}
+	return ROM_OK;
+}
+
+// one pass over the source , the first places the labels and the second resolves them and encodes into out if given
+constexpr rom_scan rom_pass(std::string_view source , unsigned origin , rom_label *labels , int &label_count , bool resolve , uint8_t *out)
+{
+	rom_scan scan;
+	size_t pos = 0;
+	int line = 1;
+	for(;;)
+	{
+		std::string_view word = rom_next(source , pos , line);
+		if(word.empty())
+			return scan;
+		scan.line = line;
+		size_t after = pos;
+		int after_line = line;
+		while(rom_next(source , after , after_line) == ":") // LABEL:
+		{
+			if(!resolve)
+			{
+				int known = rom_address(word , labels , label_count);
+				if(known == -2 || rom_number(word , true) >= 0)
+					return { ROM_BAD_LABEL , line , 0 };
+				if(known >= 0)
+					return { ROM_DUPLICATE_LABEL , line , 0 };
+				if(label_count == ROM_MAX_LABELS)
+					return { ROM_TOO_MANY_LABELS , line , 0 };
+				labels[label_count++] = { word , origin + (unsigned)scan.size };
+			}
+			pos = after;
+			word = rom_next(source , pos , line);
+			scan.line = line;
+			after = pos;
+			after_line = line;
+		}
+		int m = find_mnemonic(word);
+		if(m < 0)
+			return { ROM_UNKNOWN_MNEMONIC , line , 0 };
+
+		std::string_view ops[3];
+		int count = 0;
+		std::string_view next = rom_next(source , pos , line);
+		while(next != ";" && !next.empty() && count < 3)
+		{
+			ops[count++] = next;
+			next = rom_next(source , pos , line);
+			if(next == ",")
+				next = rom_next(source , pos , line);
+		}
+		if(next != ";")
+			return { count == 3 ? ROM_BAD_OPERANDS : ROM_MISSING_SEMICOLON , scan.line , 0 };
+		const mnemonic_def &d = MNEMONIC_LIST[m];
+		rom_error error = rom_encode(d , ops , count , labels , label_count , resolve , out == nullptr ? nullptr : out + scan.size);
+		if(error != ROM_OK)
+			return { error , scan.line , 0 };
+		scan.size += shape_length(d.shape);
+		if(origin + scan.size > 0x10000)
+			return { ROM_TOO_LONG , scan.line , 0 };
+	}
+}
+
+// size of the image or the first error
+constexpr rom_scan rom_check(std::string_view source , unsigned origin)
+{
+	std::array<rom_label , ROM_MAX_LABELS> labels = {};
+	int label_count = 0;
+	rom_scan scan = rom_pass(source , origin , labels.data() , label_count , false , nullptr);
+	if(scan.error == ROM_OK)
+		scan = rom_pass(source , origin , labels.data() , label_count , true , nullptr);
+	return scan;
+}
+
+template<size_t N>
+constexpr std::array<uint8_t , N> rom_assemble(std::string_view source , unsigned origin)
+{
+	std::array<rom_label , ROM_MAX_LABELS> labels = {};
+	int label_count = 0;
+	std::array<uint8_t , N> bytes = {};
+	rom_pass(source , origin , labels.data() , label_count , false , nullptr);
+	rom_pass(source , origin , labels.data() , label_count , true , bytes.data());
+	return bytes;
+}
+
+// instantiated for every ROM_8085 , fails with the line and the error of a source that does not assemble
+template<int LINE , rom_error ERROR>
+constexpr void rom_error_at()
+{
+	static_assert(ERROR == ROM_OK , "8085 source does not assemble , see the line and error in rom_error_at<LINE , ERROR>");
+}
+
+#define ROM_8085(origin , source) ([]() { \
+		constexpr rom_scan scan = rom_check(source , origin); \
+		rom_error_at<scan.line , scan.error>(); \
+		return rom_assemble<scan.size>(source , origin); \
+	}())
+
+#endif
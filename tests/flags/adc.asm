@@ -0,0 +1,2 @@
+ADC B;
+HLT;
@@ -0,0 +1,2 @@
+ADD B;
+HLT;
@@ -0,0 +1,2 @@
+ANA B;
+HLT;
@@ -0,0 +1,3 @@
+ADD B;
+DAA;
+HLT;
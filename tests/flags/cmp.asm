@@ -0,0 +1,2 @@
+CMP B;
+HLT;
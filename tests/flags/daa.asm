@@ -0,0 +1,2 @@
+DAA;
+HLT;
@@ -0,0 +1,2 @@
+DCR A;
+HLT;
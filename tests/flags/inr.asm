@@ -0,0 +1,2 @@
+INR A;
+HLT;
@@ -0,0 +1,2 @@
+ORA B;
+HLT;
@@ -0,0 +1,2 @@
+SBB B;
+HLT;
@@ -0,0 +1,2 @@
+SUB B;
+HLT;
@@ -0,0 +1,2 @@
+XRA B;
+HLT;
@@ -0,0 +1,94 @@
+/*
+	edits a program line by line and checks that incremental_assembler::update gives the same bytes and errors
+	as assembling the whole source again. build with main.cc : g++ -std=c++17 -pthread -DASSEMBLER_LIBRARY incremental.cc ../main.cc
+*/
+#include "../assembler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+std::string join(const std::vector<std::string> &lines)
+{
+	std::string text;
+	for(auto &line : lines)
+		text += line + "\n";
+	return text;
+}
+
+bool same(const assembly_result &a , const assembly_result &b)
+{
+	if(a.ok != b.ok || (a.ok && a.origin != b.origin) || a.bytes != b.bytes || a.diagnostics.size() != b.diagnostics.size())
+		return false;
+	for(size_t i = 0 ; i < a.diagnostics.size() ; i++)
+		if(a.diagnostics[i].line_no != b.diagnostics[i].line_no || a.diagnostics[i].message != b.diagnostics[i].message)
+			return false;
+	return true;
+}
+
+int main()
+{
+	std::vector<std::string> lines = {
+		"START: LXI H,9000H;" ,
+		"MVI B,10H;" ,
+		"LOOP: MOV M,B;" ,
+		"INX H;" ,
+		"DCR B;" ,
+		"JNZ LOOP;" ,
+		"CALL SUM;" ,
+		"JMP DONE;" ,
+		"SUM: MVI A,00H;" ,
+		"ADD B;" ,
+		"RET;" ,
+		"DONE: HLT;"
+	};
+	// every edit keeps the labels above defined , a few lines jump forward or are not valid
+	std::vector<std::string> pool = { "NOP;" , "MVI A,0FFH;" , "MOV A,B;" , "JMP DONE;" , "CALL SUM;" , "STA 0A000H;" ,
+		"LXI SP,0FFFFH;" , "JZ START;" , "MOV A,Q;" , "JMP NOWHERE;" , "" };
+	auto bad = [](const std::string &line) { return line == "MOV A,Q;" || line == "JMP NOWHERE;"; };
+
+	incremental_assembler incremental;
+	std::mt19937 random(8085);
+	int failures = 0 , steps = 0 , errors = 0;
+	auto check = [&]()
+	{
+		std::string text = join(lines);
+		const assembly_result &got = incremental.update(text);
+		assembly_result full = assemble_source(text);
+		errors += !full.ok;
+		if(!same(got , full))
+		{
+			if(failures++ < 5)
+				std::cout<<"update "<<steps<<" differs from a full assembly of :\n"<<text;
+		}
+		steps++;
+	};
+
+	check();
+	check(); // the same source again
+	for(int i = 0 ; i < 2000 ; i++)
+	{
+		// the first and last line keep START and DONE , labelled lines are never removed and now and then the bad ones go
+		size_t at = 1 + random() % (lines.size() - 1);
+		std::string line = pool[random() % pool.size()];
+		switch(random() % 5)
+		{
+			case 0 :
+				if(lines[at].find(':') == std::string::npos)
+					lines[at] = line;
+				break;
+			case 1 : lines.insert(lines.begin() + at , line); break;
+			case 2 :
+				if(lines[at].find(':') == std::string::npos && lines.size() > 12)
+					lines.erase(lines.begin() + at);
+				break;
+			case 3 : lines.insert(lines.begin() + at , "L" + std::to_string(i) + ": JMP L" + std::to_string(i) + ";"); break;
+			case 4 : lines.erase(std::remove_if(lines.begin() , lines.end() , bad) , lines.end()); break;
+		}
+		check();
+	}
+	std::cout<<steps<<" updates , "<<errors<<" with errors , "<<failures<<" differ"<<std::endl;
+	return failures == 0 ? 0 : 1;
+}
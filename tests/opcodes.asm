@@ -0,0 +1,252 @@
+NOP;
+LXI B,1234H;
+STAX B;
+INX B;
+INR B;
+DCR B;
+MVI B,5AH;
+RLC;
+DAD B;
+LDAX B;
+DCX B;
+INR C;
+DCR C;
+MVI C,5AH;
+RRC;
+LXI D,1234H;
+STAX D;
+INX D;
+INR D;
+DCR D;
+MVI D,5AH;
+RAL;
+DAD D;
+LDAX D;
+DCX D;
+INR E;
+DCR E;
+MVI E,5AH;
+RAR;
+RIM;
+LXI H,1234H;
+SHLD 1234H;
+INX H;
+INR H;
+DCR H;
+MVI H,5AH;
+DAA;
+DAD H;
+LHLD 1234H;
+DCX H;
+INR L;
+DCR L;
+MVI L,5AH;
+CMA;
+SIM;
+LXI SP,1234H;
+STA 1234H;
+INX SP;
+INR M;
+DCR M;
+MVI M,5AH;
+STC;
+DAD SP;
+LDA 1234H;
+DCX SP;
+INR A;
+DCR A;
+MVI A,5AH;
+CMC;
+MOV B,B;
+MOV B,C;
+MOV B,D;
+MOV B,E;
+MOV B,H;
+MOV B,L;
+MOV B,M;
+MOV B,A;
+MOV C,B;
+MOV C,C;
+MOV C,D;
+MOV C,E;
+MOV C,H;
+MOV C,L;
+MOV C,M;
+MOV C,A;
+MOV D,B;
+MOV D,C;
+MOV D,D;
+MOV D,E;
+MOV D,H;
+MOV D,L;
+MOV D,M;
+MOV D,A;
+MOV E,B;
+MOV E,C;
+MOV E,D;
+MOV E,E;
+MOV E,H;
+MOV E,L;
+MOV E,M;
+MOV E,A;
+MOV H,B;
+MOV H,C;
+MOV H,D;
+MOV H,E;
+MOV H,H;
+MOV H,L;
+MOV H,M;
+MOV H,A;
+MOV L,B;
+MOV L,C;
+MOV L,D;
+MOV L,E;
+MOV L,H;
+MOV L,L;
+MOV L,M;
+MOV L,A;
+MOV M,B;
+MOV M,C;
+MOV M,D;
+MOV M,E;
+MOV M,H;
+MOV M,L;
+HLT;
+MOV M,A;
+MOV A,B;
+MOV A,C;
+MOV A,D;
+MOV A,E;
+MOV A,H;
+MOV A,L;
+MOV A,M;
+MOV A,A;
+ADD B;
+ADD C;
+ADD D;
+ADD E;
+ADD H;
+ADD L;
+ADD M;
+ADD A;
+ADC B;
+ADC C;
+ADC D;
+ADC E;
+ADC H;
+ADC L;
+ADC M;
+ADC A;
+SUB B;
+SUB C;
+SUB D;
+SUB E;
+SUB H;
+SUB L;
+SUB M;
+SUB A;
+SBB B;
+SBB C;
+SBB D;
+SBB E;
+SBB H;
+SBB L;
+SBB M;
+SBB A;
+ANA B;
+ANA C;
+ANA D;
+ANA E;
+ANA H;
+ANA L;
+ANA M;
+ANA A;
+XRA B;
+XRA C;
+XRA D;
+XRA E;
+XRA H;
+XRA L;
+XRA M;
+XRA A;
+ORA B;
+ORA C;
+ORA D;
+ORA E;
+ORA H;
+ORA L;
+ORA M;
+ORA A;
+CMP B;
+CMP C;
+CMP D;
+CMP E;
+CMP H;
+CMP L;
+CMP M;
+CMP A;
+RNZ;
+POP B;
+JNZ 1234H;
+JMP 1234H;
+CNZ 1234H;
+PUSH B;
+ADI 5AH;
+RST 0;
+RZ;
+RET;
+JZ 1234H;
+CZ 1234H;
+CALL 1234H;
+ACI 5AH;
+RST 1;
+RNC;
+POP D;
+JNC 1234H;
+OUT 5AH;
+CNC 1234H;
+PUSH D;
+SUI 5AH;
+RST 2;
+RC;
+JC 1234H;
+IN 5AH;
+CC 1234H;
+SBI 5AH;
+RST 3;
+RPO;
+POP H;
+JPO 1234H;
+XTHL;
+CPO 1234H;
+PUSH H;
+ANI 5AH;
+RST 4;
+RPE;
+PCHL;
+JPE 1234H;
+XCHG;
+CPE 1234H;
+XRI 5AH;
+RST 5;
+RP;
+POP PSW;
+JP 1234H;
+DI;
+CP 1234H;
+PUSH PSW;
+ORI 5AH;
+RST 6;
+RM;
+SPHL;
+JM 1234H;
+EI;
+CM 1234H;
+CPI 5AH;
+RST 7;
+MVI A,0FFH;
+ADI 0A0H;
+LXI H,0FFFFH;
+JMP 0A000H;
+MVI B,00H;
+STA 0000H;
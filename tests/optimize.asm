@@ -0,0 +1,15 @@
+START: MVI A,05H;
+MOV B,B;
+CALL COUNT;
+JMP NEXT;
+NEXT: JZ HOP;
+CPI 07H;
+JNZ LEAVE;
+STA 9000H;
+HOP: JMP FIN;
+MVI C,01H;
+FIN: HLT;
+COUNT: INR A;
+MOV C,C;
+JMP LEAVE;
+LEAVE: RET;
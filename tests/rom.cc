@@ -0,0 +1,63 @@
+/*
+	assembles routines at compile time with ROM_8085 , checks their bytes with static_assert and checks at run time that
+	the assembler gives the same bytes. build with main.cc : g++ -std=c++17 -pthread -DASSEMBLER_LIBRARY rom.cc ../main.cc
+*/
+#include "../assembler.h"
+#include "../rom.h"
+
+#include <iostream>
+
+constexpr std::string_view DELAY_SOURCE = "MVI B,10H; LP: DCR B; JNZ LP; RET;";
+constexpr std::string_view FILL_SOURCE = "START:\tLXI H,0A000H;\n\tMVI M,0FFH;\n\tINX H;\n\tJMP START;\n";
+constexpr std::string_view CALL_SOURCE = "CALL CLEAR; HLT; CLEAR: XRA A; MOV B,A; RET;";
+
+constexpr auto DELAY = ROM_8085(0x8000 , DELAY_SOURCE);
+constexpr auto FILL = ROM_8085(0x9000 , FILL_SOURCE);
+constexpr auto CALL = ROM_8085(0x0000 , CALL_SOURCE);
+
+// operator== of std::array is not constexpr before C++20
+template<size_t N>
+constexpr bool equal(const std::array<uint8_t , N> &a , const std::array<uint8_t , N> &b)
+{
+	for(size_t i = 0 ; i < N ; i++)
+		if(a[i] != b[i])
+			return false;
+	return true;
+}
+static_assert(equal(DELAY , { 0x06 , 0x10 , 0x05 , 0xC2 , 0x02 , 0x80 , 0xC9 }));
+static_assert(equal(FILL , { 0x21 , 0x00 , 0xA0 , 0x36 , 0xFF , 0x23 , 0xC3 , 0x00 , 0x90 }));
+static_assert(equal(CALL , { 0xCD , 0x04 , 0x00 , 0x76 , 0xAF , 0x47 , 0xC9 }));
+
+// sources that do not assemble , with the statement holding the error
+constexpr bool fails(std::string_view source , rom_error error , int line , unsigned origin = 0x8000)
+{
+	rom_scan scan = rom_check(source , origin);
+	return scan.error == error && scan.line == line;
+}
+static_assert(fails("NOP; FOO;" , ROM_UNKNOWN_MNEMONIC , 2));
+static_assert(fails("NOP; MVI A,1234H;" , ROM_BAD_OPERANDS , 2));
+static_assert(fails("RST 8;" , ROM_BAD_RESTART , 1));
+static_assert(fails("MOV M,M;" , ROM_MOV_M_M , 1));
+static_assert(fails("NOP; JMP AWAY;" , ROM_UNDEFINED_LABEL , 2));
+static_assert(fails("LP: NOP; LP: NOP;" , ROM_DUPLICATE_LABEL , 2));
+static_assert(fails("L: NOP;" , ROM_BAD_LABEL , 1));
+static_assert(fails("NOP; LXI H,0FFFFH;" , ROM_TOO_LONG , 2 , 0xFFFD));
+static_assert(rom_check("NOP; LXI H,0FFFFH;" , 0xFFFC).error == ROM_OK); // ends on FFFF
+
+template<size_t N>
+bool same_as_assembler(const char *name , const std::array<uint8_t , N> &rom , std::string_view source , const char *start_point)
+{
+	assembly_result r = assemble_source(source , start_point);
+	if(r.ok && std::vector<unsigned char>(rom.begin() , rom.end()) == r.bytes)
+		return true;
+	std::cout<<name<<" differs from the assembler"<<std::endl;
+	return false;
+}
+
+int main()
+{
+	bool ok = same_as_assembler("DELAY" , DELAY , DELAY_SOURCE , "8000");
+	ok = same_as_assembler("FILL" , FILL , FILL_SOURCE , "9000") && ok;
+	ok = same_as_assembler("CALL" , CALL , CALL_SOURCE , "0000") && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# builds the assembler and checks every case against its expected output , run from anywhere : sh tests/run.sh
+cd "$(dirname "$0")" || exit 1
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+CXX=${CXX:-g++}
+FLAGS="-std=c++17 -O2 -pthread -Wall -Wextra"
+failed=0
+
+check()
+{
+	if "$@" ; then echo "pass $NAME" ; else echo "FAIL $NAME" ; failed=1 ; return 1 ; fi
+}
+
+# name.asm assembled from 8000 with the given options must give name.dat
+assemble()
+{
+	NAME=$1 ; shift
+	"$OUT/asm" "$NAME.asm" 8000 "$@" -o "$OUT/$NAME.dat" > "$OUT/$NAME.log" 2>&1
+	check cmp -s "$OUT/$NAME.dat" "$NAME.dat"
+}
+
+# every job of a manifest must pass
+batch()
+{
+	NAME="$*"
+	"$OUT/asm" --batch "$@" > "$OUT/batch.log" 2>&1
+	check test $? = 0 || grep -v "pass" "$OUT/batch.log"
+}
+
+# a test program built with the assembler as a library must exit with 0
+program()
+{
+	NAME=$1
+	$CXX $FLAGS -DASSEMBLER_LIBRARY "$1.cc" ../main.cc -o "$OUT/$1" && "$OUT/$1" > "$OUT/$1.log" 2>&1
+	check test $? = 0 || cat "$OUT/$1.log"
+}
+
+NAME=build
+check $CXX $FLAGS ../main.cc -o "$OUT/asm"
+[ $failed = 0 ] || exit 1
+
+assemble opcodes
+assemble optimize -O
+batch flags/flags.txt
+batch flags/flags.txt --no-cache
+program incremental
+program rom
+
+exit $failed
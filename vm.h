@@ -0,0 +1,981 @@
+#ifndef VM_H
+#define VM_H
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "opcodes.h"
+
+/*
+	8085 virtual machine.
+
+	every opcode has its own handler generated from vm_op<OP> , the operand fields of the opcode are decoded at
+	compile time so a handler is the bare data path of one instruction. the interpreter loop fetches the opcode
+	and calls through the 256 entry VM_HANDLERS table. T-states are taken from OPCODE_TABLE of opcodes.h.
+	vm_run_cached runs the same handlers over predecoded basic blocks (see BLOCK CACHE below).
+========================================================================
+	registers are kept in reg[] by their register code : B=0 C=1 D=2 E=3 H=4 L=5 A=7 , reg[6] is unused (M)
+	flags : S Z - AC - P - CY
+*/
+
+#define FLAG_S 0x80
+#define FLAG_Z 0x40
+#define FLAG_AC 0x10
+#define FLAG_P 0x04
+#define FLAG_CY 0x01
+
+#define REG_B 0
+#define REG_C 1
+#define REG_D 2
+#define REG_E 3
+#define REG_H 4
+#define REG_L 5
+#define REG_M 6
+#define REG_A 7
+
+#define VM_MEMORY_SIZE 0x10000
+
+enum VM_STATUS { VM_RUNNING , VM_HALTED , VM_ILLEGAL , VM_EVENT }; // VM_EVENT : a device wants the loop left , see devices.h
+
+struct machine;
+struct block_cache;
+struct device_bus;
+struct micro_op;
+typedef void (*vm_uop_handler)(machine & , const micro_op &);
+
+// one predecoded instruction (or a fused pair) of a cached block
+struct micro_op
+{
+	vm_uop_handler fn;
+	unsigned short imm; // 8 or 16 bit operand
+	unsigned short next_pc; // address after the instruction
+	unsigned char data; // second operand of a fused pair
+	unsigned char count; // instructions covered
+	unsigned char t_states; // not taken T-states , added by the runner instead of the handler
+};
+
+#define VM_LINE_SHIFT 6 // code is tracked for self modifying writes in lines of 64 bytes
+#define VM_LINE_CODE 1 // the line holds cached code
+#define VM_LINE_DEVICE 2 // the line holds registers of a device
+
+struct machine
+{
+	unsigned char reg[8] = {};
+	unsigned char F = 0;
+	unsigned short SP = 0;
+	unsigned short PC = 0;
+	bool inte = false; // interrupts enabled by EI
+	unsigned char int_mask = 0x07; // RST 7.5 6.5 5.5 masks set by SIM
+	unsigned char int_pending = 0; // RST 7.5 6.5 5.5 raised by devices , bit 0 is 5.5 like the masks
+	VM_STATUS status = VM_RUNNING;
+	unsigned long long cycles = 0;
+	unsigned long long instructions = 0;
+	std::array<unsigned char , 256> ports = {}; // IN and OUT
+	std::array<unsigned char , VM_MEMORY_SIZE> memory = {};
+
+	// block cache state , cache stays set after vm_run_cached so writes between runs drop stale blocks too
+	block_cache *cache = nullptr;
+	bool stop = false; // leave the current block , set by HLT , undefined opcodes , devices and writes into cached code
+	std::array<unsigned char , (VM_MEMORY_SIZE >> VM_LINE_SHIFT)> watch_lines = {}; // VM_LINE_CODE and VM_LINE_DEVICE
+
+	// device bus , io_write is called after a write into a VM_LINE_DEVICE line and io_port before IN and after OUT
+	device_bus *bus = nullptr;
+	void (*io_write)(machine & , unsigned short addr) = nullptr;
+	void (*io_port)(machine & , unsigned char port , bool out) = nullptr;
+};
+
+void vm_invalidate(machine &m , unsigned short addr);
+
+/*=================================FLAGS===========================================*/
+constexpr std::array<unsigned char , 256> build_szp_table()
+{
+	std::array<unsigned char , 256> table{};
+	for(int v = 0 ; v < 256 ; v++)
+	{
+		int bits = 0;
+		for(int b = 0 ; b < 8 ; b++)
+			bits += (v >> b) & 1;
+		table[v] = (v & 0x80 ? FLAG_S : 0) | (v == 0 ? FLAG_Z : 0) | (bits % 2 == 0 ? FLAG_P : 0);
+	}
+	return table;
+}
+
+constexpr std::array<unsigned char , 256> SZP_TABLE = build_szp_table();
+
+/*=================================ACCESS==========================================*/
+inline unsigned short vm_hl(const machine &m) { return m.reg[REG_H] << 8 | m.reg[REG_L]; }
+
+inline unsigned char vm_fetch(machine &m) { return m.memory[m.PC++]; }
+
+inline unsigned short vm_fetch16(machine &m)
+{
+	unsigned short lo = vm_fetch(m);
+	return lo | vm_fetch(m) << 8;
+}
+
+// kept out of vm_write , most writes go to lines nobody watches. cached code is dropped by any write through
+// vm_write once a cache ran on the machine : in or out of vm_run_cached , by an interrupt or by the host
+inline void vm_watched_write(machine &m , unsigned short addr , unsigned char watch)
+{
+	if((watch & VM_LINE_CODE) && m.cache != nullptr)
+		vm_invalidate(m , addr);
+	if((watch & VM_LINE_DEVICE) && m.io_write != nullptr)
+		m.io_write(m , addr);
+}
+
+// every write is checked against the lines holding device registers or cached code
+template<bool PRE> inline void vm_write(machine &m , unsigned short addr , unsigned char v)
+{
+	m.memory[addr] = v;
+	if(unsigned char watch = m.watch_lines[addr >> VM_LINE_SHIFT])
+		vm_watched_write(m , addr , watch);
+}
+
+// operands come from memory or , for cached blocks , from the predecoded micro op
+template<bool PRE> inline unsigned char vm_imm8(machine &m , const micro_op &u)
+{
+	if constexpr(PRE)
+		return u.imm;
+	else
+		return vm_fetch(m);
+}
+
+template<bool PRE> inline unsigned short vm_imm16(machine &m , const micro_op &u)
+{
+	if constexpr(PRE)
+		return u.imm;
+	else
+		return vm_fetch16(m);
+}
+
+template<bool PRE> inline void vm_push(machine &m , unsigned short v)
+{
+	vm_write<PRE>(m , --m.SP , v >> 8);
+	vm_write<PRE>(m , --m.SP , v & 0xFF);
+}
+
+inline unsigned short vm_pop(machine &m)
+{
+	unsigned short lo = m.memory[m.SP++];
+	return lo | m.memory[m.SP++] << 8;
+}
+
+template<int R> inline unsigned char vm_get(const machine &m)
+{
+	if constexpr(R == REG_M)
+		return m.memory[vm_hl(m)];
+	else
+		return m.reg[R];
+}
+
+template<int R , bool PRE> inline void vm_set(machine &m , unsigned char v)
+{
+	if constexpr(R == REG_M)
+		vm_write<PRE>(m , vm_hl(m) , v);
+	else
+		m.reg[R] = v;
+}
+
+// register pair B=0 D=1 H=2 SP=3
+template<int RP> inline unsigned short vm_get_pair(const machine &m)
+{
+	if constexpr(RP == 3)
+		return m.SP;
+	else
+		return m.reg[2*RP] << 8 | m.reg[2*RP+1];
+}
+
+template<int RP> inline void vm_set_pair(machine &m , unsigned short v)
+{
+	if constexpr(RP == 3)
+		m.SP = v;
+	else
+	{
+		m.reg[2*RP] = v >> 8;
+		m.reg[2*RP+1] = v & 0xFF;
+	}
+}
+
+// condition codes NZ Z NC C PO PE P M
+template<int CC> inline bool vm_condition(const machine &m)
+{
+	constexpr unsigned char FLAG[4] = {FLAG_Z , FLAG_CY , FLAG_P , FLAG_S};
+	bool set = m.F & FLAG[CC >> 1];
+	return CC & 1 ? set : !set;
+}
+
+/*=================================ALU=============================================*/
+// ADD ADC SUB SBB ANA XRA ORA CMP
+template<int ALU> inline void vm_alu(machine &m , unsigned char v)
+{
+	unsigned int a = m.reg[REG_A];
+	if constexpr(ALU == 0 || ALU == 1)
+	{
+		unsigned int c = ALU == 1 ? (m.F & FLAG_CY) : 0;
+		unsigned int r = a + v + c;
+		m.F = SZP_TABLE[r & 0xFF] | (r >> 8) | (((a & 0xF) + (v & 0xF) + c) & FLAG_AC);
+		m.reg[REG_A] = r;
+	}
+	else if constexpr(ALU == 2 || ALU == 3 || ALU == 7)
+	{
+		unsigned int c = ALU == 3 ? (m.F & FLAG_CY) : 0;
+		unsigned int r = a - v - c;
+		m.F = SZP_TABLE[r & 0xFF] | ((r >> 8) & FLAG_CY) | (((a & 0xF) + (~v & 0xF) + (1 - c)) & FLAG_AC);
+		if constexpr(ALU != 7)
+			m.reg[REG_A] = r;
+	}
+	else if constexpr(ALU == 4)
+	{
+		m.reg[REG_A] = a & v;
+		m.F = SZP_TABLE[m.reg[REG_A]] | FLAG_AC;
+	}
+	else if constexpr(ALU == 5)
+	{
+		m.reg[REG_A] = a ^ v;
+		m.F = SZP_TABLE[m.reg[REG_A]];
+	}
+	else
+	{
+		m.reg[REG_A] = a | v;
+		m.F = SZP_TABLE[m.reg[REG_A]];
+	}
+}
+
+inline void vm_daa(machine &m)
+{
+	unsigned int a = m.reg[REG_A];
+	unsigned int correction = 0;
+	unsigned char cy = m.F & FLAG_CY;
+	if((a & 0xF) > 9 || (m.F & FLAG_AC))
+		correction |= 0x06;
+	if(a > 0x99 || cy)
+	{
+		correction |= 0x60;
+		cy = FLAG_CY;
+	}
+	unsigned int r = a + correction;
+	m.F = SZP_TABLE[r & 0xFF] | cy | (((a & 0xF) + (correction & 0xF)) & FLAG_AC);
+	m.reg[REG_A] = r;
+}
+
+/*=================================HANDLERS========================================*/
+// control transfers , HLT and undefined opcodes end a cached block
+constexpr bool vm_ends_block(unsigned char op)
+{
+	return op == 0xC3 || op == 0xCD || op == 0xC9 || op == 0xE9 || op == 0x76
+		|| (op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4 || (op & 0xC7) == 0xC0 || (op & 0xC7) == 0xC7
+		|| OPCODE_TABLE[op].mnemonic == NO_MNEMONIC;
+}
+
+template<int OP , bool PRE> inline void vm_exec(machine &m , const micro_op &u)
+{
+	constexpr int DST = (OP >> 3) & 7;
+	constexpr int SRC = OP & 7;
+	constexpr int RP = (OP >> 4) & 3;
+	constexpr int TAKEN = OPCODE_TABLE[OP].t_max - OPCODE_TABLE[OP].t_min; // extra T-states of a taken branch
+
+	if constexpr(!PRE)
+		m.cycles += OPCODE_TABLE[OP].t_min;
+	else if constexpr(vm_ends_block(OP)) // the only micro ops that look at PC , it is not kept up to date in a block
+		m.PC = u.next_pc;
+
+	if constexpr(OPCODE_TABLE[OP].mnemonic == NO_MNEMONIC)
+	{
+		m.PC--;
+		m.status = VM_ILLEGAL;
+		m.stop = true;
+	}
+	else if constexpr(OP == 0x76) // HLT
+	{
+		m.status = VM_HALTED;
+		m.stop = true;
+	}
+	else if constexpr(OP >= 0x40 && OP < 0x80) // MOV
+		vm_set<DST , PRE>(m , vm_get<SRC>(m));
+	else if constexpr(OP >= 0x80 && OP < 0xC0) // ADD .. CMP
+		vm_alu<DST>(m , vm_get<SRC>(m));
+	else if constexpr((OP & 0xC7) == 0xC6) // ADI .. CPI
+		vm_alu<DST>(m , vm_imm8<PRE>(m , u));
+	else if constexpr((OP & 0xC7) == 0x06) // MVI
+		vm_set<DST , PRE>(m , vm_imm8<PRE>(m , u));
+	else if constexpr((OP & 0xC7) == 0x04) // INR
+	{
+		unsigned char r = vm_get<DST>(m) + 1;
+		vm_set<DST , PRE>(m , r);
+		m.F = (m.F & FLAG_CY) | SZP_TABLE[r] | ((r & 0xF) == 0 ? FLAG_AC : 0);
+	}
+	else if constexpr((OP & 0xC7) == 0x05) // DCR
+	{
+		unsigned char r = vm_get<DST>(m) - 1;
+		vm_set<DST , PRE>(m , r);
+		m.F = (m.F & FLAG_CY) | SZP_TABLE[r] | ((r & 0xF) != 0xF ? FLAG_AC : 0);
+	}
+	else if constexpr((OP & 0xCF) == 0x01) // LXI
+		vm_set_pair<RP>(m , vm_imm16<PRE>(m , u));
+	else if constexpr((OP & 0xCF) == 0x03) // INX
+		vm_set_pair<RP>(m , vm_get_pair<RP>(m) + 1);
+	else if constexpr((OP & 0xCF) == 0x0B) // DCX
+		vm_set_pair<RP>(m , vm_get_pair<RP>(m) - 1);
+	else if constexpr((OP & 0xCF) == 0x09) // DAD
+	{
+		unsigned int r = vm_hl(m) + vm_get_pair<RP>(m);
+		vm_set_pair<2>(m , r);
+		m.F = (m.F & ~FLAG_CY) | (r >> 16);
+	}
+	else if constexpr((OP & 0xEF) == 0x02) // STAX
+		vm_write<PRE>(m , vm_get_pair<RP>(m) , m.reg[REG_A]);
+	else if constexpr((OP & 0xEF) == 0x0A) // LDAX
+		m.reg[REG_A] = m.memory[vm_get_pair<RP>(m)];
+	else if constexpr((OP & 0xCF) == 0xC5) // PUSH
+	{
+		if constexpr(RP == 3)
+			vm_push<PRE>(m , m.reg[REG_A] << 8 | m.F);
+		else
+			vm_push<PRE>(m , vm_get_pair<RP>(m));
+	}
+	else if constexpr((OP & 0xCF) == 0xC1) // POP
+	{
+		unsigned short v = vm_pop(m);
+		if constexpr(RP == 3)
+		{
+			m.reg[REG_A] = v >> 8;
+			m.F = v & 0xFF;
+		}
+		else
+			vm_set_pair<RP>(m , v);
+	}
+	else if constexpr(OP == 0xC3) // JMP
+		m.PC = vm_imm16<PRE>(m , u);
+	else if constexpr((OP & 0xC7) == 0xC2) // Jcc
+	{
+		unsigned short addr = vm_imm16<PRE>(m , u);
+		if(vm_condition<DST>(m))
+		{
+			m.PC = addr;
+			m.cycles += TAKEN;
+		}
+	}
+	else if constexpr(OP == 0xCD) // CALL
+	{
+		unsigned short addr = vm_imm16<PRE>(m , u);
+		vm_push<PRE>(m , m.PC);
+		m.PC = addr;
+	}
+	else if constexpr((OP & 0xC7) == 0xC4) // Ccc
+	{
+		unsigned short addr = vm_imm16<PRE>(m , u);
+		if(vm_condition<DST>(m))
+		{
+			vm_push<PRE>(m , m.PC);
+			m.PC = addr;
+			m.cycles += TAKEN;
+		}
+	}
+	else if constexpr(OP == 0xC9) // RET
+		m.PC = vm_pop(m);
+	else if constexpr((OP & 0xC7) == 0xC0) // Rcc
+	{
+		if(vm_condition<DST>(m))
+		{
+			m.PC = vm_pop(m);
+			m.cycles += TAKEN;
+		}
+	}
+	else if constexpr((OP & 0xC7) == 0xC7) // RST
+	{
+		vm_push<PRE>(m , m.PC);
+		m.PC = DST * 8;
+	}
+	else if constexpr(OP == 0x32) // STA
+		vm_write<PRE>(m , vm_imm16<PRE>(m , u) , m.reg[REG_A]);
+	else if constexpr(OP == 0x3A) // LDA
+		m.reg[REG_A] = m.memory[vm_imm16<PRE>(m , u)];
+	else if constexpr(OP == 0x22) // SHLD
+	{
+		unsigned short addr = vm_imm16<PRE>(m , u);
+		vm_write<PRE>(m , addr , m.reg[REG_L]);
+		vm_write<PRE>(m , addr + 1 , m.reg[REG_H]);
+	}
+	else if constexpr(OP == 0x2A) // LHLD
+	{
+		unsigned short addr = vm_imm16<PRE>(m , u);
+		m.reg[REG_L] = m.memory[addr];
+		m.reg[REG_H] = m.memory[(unsigned short)(addr + 1)];
+	}
+	else if constexpr(OP == 0xEB) // XCHG
+	{
+		std::swap(m.reg[REG_H] , m.reg[REG_D]);
+		std::swap(m.reg[REG_L] , m.reg[REG_E]);
+	}
+	else if constexpr(OP == 0xE3) // XTHL
+	{
+		unsigned char l = m.memory[m.SP];
+		unsigned char h = m.memory[(unsigned short)(m.SP + 1)];
+		vm_write<PRE>(m , m.SP , m.reg[REG_L]);
+		vm_write<PRE>(m , m.SP + 1 , m.reg[REG_H]);
+		m.reg[REG_L] = l;
+		m.reg[REG_H] = h;
+	}
+	else if constexpr(OP == 0xF9) // SPHL
+		m.SP = vm_hl(m);
+	else if constexpr(OP == 0xE9) // PCHL
+		m.PC = vm_hl(m);
+	else if constexpr(OP == 0x07) // RLC
+	{
+		unsigned char a = m.reg[REG_A];
+		m.reg[REG_A] = a << 1 | a >> 7;
+		m.F = (m.F & ~FLAG_CY) | (a >> 7);
+	}
+	else if constexpr(OP == 0x0F) // RRC
+	{
+		unsigned char a = m.reg[REG_A];
+		m.reg[REG_A] = a >> 1 | a << 7;
+		m.F = (m.F & ~FLAG_CY) | (a & 1);
+	}
+	else if constexpr(OP == 0x17) // RAL
+	{
+		unsigned char a = m.reg[REG_A];
+		m.reg[REG_A] = a << 1 | (m.F & FLAG_CY);
+		m.F = (m.F & ~FLAG_CY) | (a >> 7);
+	}
+	else if constexpr(OP == 0x1F) // RAR
+	{
+		unsigned char a = m.reg[REG_A];
+		m.reg[REG_A] = a >> 1 | (m.F & FLAG_CY) << 7;
+		m.F = (m.F & ~FLAG_CY) | (a & 1);
+	}
+	else if constexpr(OP == 0x27) // DAA
+		vm_daa(m);
+	else if constexpr(OP == 0x2F) // CMA
+		m.reg[REG_A] = ~m.reg[REG_A];
+	else if constexpr(OP == 0x37) // STC
+		m.F |= FLAG_CY;
+	else if constexpr(OP == 0x3F) // CMC
+		m.F ^= FLAG_CY;
+	else if constexpr(OP == 0xDB) // IN
+	{
+		unsigned char port = vm_imm8<PRE>(m , u);
+		if(m.io_port != nullptr)
+			m.io_port(m , port , false);
+		m.reg[REG_A] = m.ports[port];
+	}
+	else if constexpr(OP == 0xD3) // OUT
+	{
+		unsigned char port = vm_imm8<PRE>(m , u);
+		m.ports[port] = m.reg[REG_A];
+		if(m.io_port != nullptr)
+			m.io_port(m , port , true);
+	}
+	else if constexpr(OP == 0xFB) // EI
+	{
+		m.inte = true;
+		if(m.int_pending) // taken by the device bus
+		{
+			m.status = VM_EVENT;
+			m.stop = true;
+		}
+	}
+	else if constexpr(OP == 0xF3) // DI
+		m.inte = false;
+	else if constexpr(OP == 0x20) // RIM
+		m.reg[REG_A] = m.int_pending << 4 | (m.inte ? 0x08 : 0) | (m.int_mask & 0x07);
+	else if constexpr(OP == 0x30) // SIM
+	{
+		if(m.reg[REG_A] & 0x08)
+			m.int_mask = m.reg[REG_A] & 0x07;
+		if(m.reg[REG_A] & 0x10) // R7.5
+			m.int_pending &= ~0x04;
+	}
+	// NOP does nothing
+}
+
+// handler of the plain interpreter , operands are fetched from memory at PC
+template<int OP> void vm_op(machine &m)
+{
+	static const micro_op NONE = {};
+	vm_exec<OP , false>(m , NONE);
+}
+
+typedef void (*vm_handler)(machine &);
+
+template<size_t... OP> constexpr std::array<vm_handler , 256> build_vm_handlers(std::index_sequence<OP...>)
+{
+	return {{ &vm_op<OP>... }};
+}
+
+inline constexpr std::array<vm_handler , 256> VM_HANDLERS = build_vm_handlers(std::make_index_sequence<256>());
+
+/*=================================INTERPRETER=====================================*/
+// copies the program into memory and points PC at it
+inline void vm_load(machine &m , unsigned short origin , const unsigned char *bytes , size_t size)
+{
+	for(size_t i = 0 ; i < size ; i++)
+		m.memory[(unsigned short)(origin + i)] = bytes[i];
+	m.PC = origin;
+	m.status = VM_RUNNING;
+}
+
+// runs until HLT , an undefined opcode or until the cycle count reaches max_cycles
+inline VM_STATUS vm_run(machine &m , unsigned long long max_cycles)
+{
+	while(m.status == VM_RUNNING && m.cycles < max_cycles)
+	{
+		VM_HANDLERS[m.memory[m.PC++]](m);
+		m.instructions++;
+	}
+	return m.status;
+}
+
+/*=================================BLOCK CACHE=====================================*/
+/*
+	code is predecoded into basic blocks of micro ops the first time execution enters it. a block ends after a
+	control transfer , before a jump target of the program or after VM_BLOCK_OPS micro ops. MVI A,d;STA and
+	DCR r;JNZ are fused into one micro op. a write into a line holding cached code drops every block covering
+	the written byte and leaves the running block , so self modifying code is decoded again. every line keeps the
+	blocks over it , so the write only looks at those.
+	the machine keeps the cache after vm_run_cached returns (m.cache) , the cache must outlive it or be taken off
+	with m.cache = nullptr.
+	T-states are counted per micro op before it runs , devices see the same cycle as under vm_run. without a bus
+	nothing looks at them inside a block and the block adds them at once.
+	a block that would run past the cycle limit is left to vm_run , so the run ends at the same instruction.
+*/
+#define VM_BLOCK_OPS 64
+
+struct vm_block
+{
+	unsigned short start;
+	unsigned int size; // bytes covered
+	bool ends_with_jump; // the last micro op sets PC itself
+	unsigned int t_states; // not taken T-states of the whole block
+	unsigned int count; // instructions in the block
+	std::vector<micro_op> ops;
+};
+
+struct block_cache
+{
+	std::vector<std::unique_ptr<vm_block>> blocks = std::vector<std::unique_ptr<vm_block>>(VM_MEMORY_SIZE); // by start address
+	std::vector<unsigned char> leaders = std::vector<unsigned char>(VM_MEMORY_SIZE); // jump targets , a block never runs over one
+	std::vector<std::unique_ptr<vm_block>> retired; // dropped blocks that may still be running
+	std::vector<unsigned short> starts; // where blocks were built , to clear the cache without a full scan
+	// starts of the blocks over every line of VM_LINE_SHIFT bytes , a dropped block leaves when its line is written
+	std::vector<std::vector<unsigned short>> lines = std::vector<std::vector<unsigned short>>(VM_MEMORY_SIZE >> VM_LINE_SHIFT);
+	std::vector<unsigned short> covered = std::vector<unsigned short>(VM_MEMORY_SIZE); // blocks over every byte , data next to code is 0
+	unsigned long long built = 0;
+	unsigned long long invalidated = 0;
+};
+
+template<int OP> void vm_uop(machine &m , const micro_op &u)
+{
+	vm_exec<OP , true>(m , u);
+}
+
+template<size_t... OP> constexpr std::array<vm_uop_handler , 256> build_vm_uop_handlers(std::index_sequence<OP...>)
+{
+	return {{ &vm_uop<OP>... }};
+}
+
+inline constexpr std::array<vm_uop_handler , 256> VM_UOP_HANDLERS = build_vm_uop_handlers(std::make_index_sequence<256>());
+
+// MVI A,d ; STA addr
+inline void vm_uop_mvi_sta(machine &m , const micro_op &u)
+{
+	m.reg[REG_A] = u.data;
+	vm_write<true>(m , u.imm , u.data);
+}
+
+// DCR r ; JNZ addr
+template<int R> void vm_uop_dcr_jnz(machine &m , const micro_op &u)
+{
+	vm_exec<0x05 | R << 3 , true>(m , u);
+	vm_exec<0xC2 , true>(m , u);
+}
+
+constexpr std::array<vm_uop_handler , 8> VM_DCR_JNZ = {{
+	&vm_uop_dcr_jnz<0> , &vm_uop_dcr_jnz<1> , &vm_uop_dcr_jnz<2> , &vm_uop_dcr_jnz<3> ,
+	&vm_uop_dcr_jnz<4> , &vm_uop_dcr_jnz<5> , &vm_uop_dcr_jnz<6> , &vm_uop_dcr_jnz<7>
+}};
+
+// an instruction wrapping around the end of memory is left to the plain interpreter , imm is its address
+inline void vm_uop_interpret(machine &m , const micro_op &u)
+{
+	m.PC = u.imm;
+	VM_HANDLERS[m.memory[m.PC++]](m);
+	m.stop = true;
+}
+
+inline vm_block *vm_build_block(machine &m , block_cache &cache , unsigned short start)
+{
+	auto b = std::make_unique<vm_block>();
+	b->start = start;
+	b->ends_with_jump = false;
+	b->t_states = 0;
+	b->count = 0;
+	unsigned int pc = start;
+	const std::array<unsigned char , VM_MEMORY_SIZE> &mem = m.memory;
+	while(b->ops.size() < VM_BLOCK_OPS)
+	{
+		unsigned char op = mem[pc];
+		unsigned int length = OPCODE_TABLE[op].mnemonic == NO_MNEMONIC ? 1 : OPCODE_TABLE[op].length;
+		if(pc + length > VM_MEMORY_SIZE)
+		{
+			if(b->ops.empty())
+			{
+				b->ops.push_back({&vm_uop_interpret , static_cast<unsigned short>(pc) , static_cast<unsigned short>(pc + length) , 0 , 1 , 0});
+				pc += length;
+			}
+			break;
+		}
+
+		micro_op u = {VM_UOP_HANDLERS[op] , 0 , static_cast<unsigned short>(pc + length) , 0 , 1 , OPCODE_TABLE[op].t_min};
+		if(length == 2)
+			u.imm = mem[pc + 1];
+		else if(length == 3)
+			u.imm = mem[pc + 1] | mem[pc + 2] << 8;
+
+		unsigned int next = pc + length;
+		if(op == 0x3E && next + 3 <= VM_MEMORY_SIZE && mem[next] == 0x32 && !cache.leaders[next])
+		{
+			u = {&vm_uop_mvi_sta , static_cast<unsigned short>(mem[next + 1] | mem[next + 2] << 8) , static_cast<unsigned short>(next + 3) , mem[pc + 1] , 2 ,
+				static_cast<unsigned char>(OPCODE_TABLE[op].t_min + OPCODE_TABLE[0x32].t_min)};
+			length += 3;
+		}
+		else if((op & 0xC7) == 0x05 && next + 3 <= VM_MEMORY_SIZE && mem[next] == 0xC2 && !cache.leaders[next])
+		{
+			u = {VM_DCR_JNZ[(op >> 3) & 7] , static_cast<unsigned short>(mem[next + 1] | mem[next + 2] << 8) , static_cast<unsigned short>(next + 3) , 0 , 2 ,
+				static_cast<unsigned char>(OPCODE_TABLE[op].t_min + OPCODE_TABLE[0xC2].t_min)};
+			length += 3;
+			op = 0xC2;
+		}
+
+		b->ops.push_back(u);
+		b->t_states += u.t_states;
+		b->count += u.count;
+		pc += length;
+		if(vm_ends_block(op))
+		{
+			b->ends_with_jump = true;
+			break;
+		}
+		if(pc >= VM_MEMORY_SIZE || cache.leaders[pc])
+			break;
+	}
+	if(b->ops.back().fn == &vm_uop_interpret)
+		b->ends_with_jump = true;
+	b->size = pc - start;
+	for(unsigned int a = start ; a < pc ; a++)
+		cache.covered[a]++;
+	for(unsigned int line = start >> VM_LINE_SHIFT ; line <= (pc - 1) >> VM_LINE_SHIFT ; line++)
+	{
+		m.watch_lines[line] |= VM_LINE_CODE;
+		std::vector<unsigned short> &over = cache.lines[line];
+		if(std::find(over.begin() , over.end() , start) == over.end()) // still there if a block at start was dropped
+			over.push_back(start);
+	}
+	cache.built++;
+	cache.starts.push_back(start);
+	cache.blocks[start] = std::move(b);
+	return cache.blocks[start].get();
+}
+
+inline void vm_uncover(block_cache &cache , const vm_block &b)
+{
+	for(unsigned int a = b.start ; a < b.start + b.size ; a++)
+		cache.covered[a]--;
+}
+
+// drops the blocks covering addr , they are kept in retired until the running block is left
+inline void vm_invalidate(machine &m , unsigned short addr)
+{
+	block_cache &cache = *m.cache;
+	if(cache.covered[addr] == 0) // data sharing the line with code
+		return;
+	std::vector<unsigned short> &over = cache.lines[addr >> VM_LINE_SHIFT];
+	for(size_t i = 0 ; i < over.size() ; )
+	{
+		std::unique_ptr<vm_block> &b = cache.blocks[over[i]];
+		if(b && addr >= b->start && addr < b->start + b->size)
+		{
+			vm_uncover(cache , *b);
+			cache.retired.push_back(std::move(b));
+			cache.invalidated++;
+			m.stop = true;
+		}
+		if(b)
+			i++;
+		else // dropped now or before
+		{
+			over[i] = over.back();
+			over.pop_back();
+		}
+	}
+	if(over.empty())
+		m.watch_lines[addr >> VM_LINE_SHIFT] &= ~VM_LINE_CODE;
+}
+
+// marks the jump targets known to the assembler so blocks are split there
+inline void vm_add_leaders(block_cache &cache , const std::vector<unsigned short> &targets)
+{
+	for(unsigned short t : targets)
+		cache.leaders[t] = 1;
+}
+
+// forgets every block , the jump targets are kept
+inline void vm_drop_blocks(block_cache &cache)
+{
+	for(unsigned short start : cache.starts)
+		if(vm_block *b = cache.blocks[start].get())
+		{
+			for(unsigned int line = start >> VM_LINE_SHIFT ; line <= (start + b->size - 1u) >> VM_LINE_SHIFT ; line++)
+				cache.lines[line].clear();
+			vm_uncover(cache , *b);
+			cache.blocks[start].reset();
+		}
+	cache.starts.clear();
+}
+
+// forgets every block and jump target so the cache can be used for another program
+inline void vm_clear_cache(block_cache &cache)
+{
+	vm_drop_blocks(cache);
+	std::fill(cache.leaders.begin() , cache.leaders.end() , 0);
+}
+
+// same as vm_run but over cached blocks
+inline VM_STATUS vm_run_cached(machine &m , block_cache &cache , unsigned long long max_cycles)
+{
+	m.cache = &cache;
+	while(m.status == VM_RUNNING && m.cycles < max_cycles)
+	{
+		cache.retired.clear();
+		vm_block *b = cache.blocks[m.PC].get();
+		if(b == nullptr)
+			b = vm_build_block(m , cache , m.PC);
+		if(m.cycles + b->t_states > max_cycles) // the limit may fall inside the block , stop at the same instruction as vm_run
+		{
+			vm_run(m , max_cycles);
+			break;
+		}
+		m.stop = false;
+		const micro_op *u = b->ops.data();
+		const micro_op *end = u + b->ops.size();
+		if(m.bus != nullptr)
+			for( ; u != end ; u++)
+			{
+				m.cycles += u->t_states; // before the micro op like the interpreter , so devices see the same T-state
+				u->fn(m , *u);
+				if(m.stop)
+					break;
+			}
+		else
+		{
+			m.cycles += b->t_states;
+			for( ; u != end ; u++)
+			{
+				u->fn(m , *u);
+				if(m.stop)
+					break;
+			}
+			if(u != end)
+				for(const micro_op *k = u + 1 ; k != end ; k++)
+					m.cycles -= k->t_states;
+		}
+		if(u == end) // the whole block ran
+		{
+			m.instructions += b->count;
+			if(!b->ends_with_jump)
+				m.PC = b->start + b->size;
+		}
+		else // left after u , count what ran and , unless u set PC itself , continue after u
+		{
+			for(const micro_op *k = b->ops.data() ; k <= u ; k++)
+				m.instructions += k->count;
+			if(u + 1 != end || !b->ends_with_jump)
+				m.PC = u->next_pc;
+		}
+	}
+	cache.retired.clear();
+	return m.status;
+}
+
+/*===================================SNAPSHOTS=====================================*/
+/*
+	a snapshot is the state of a machine at one point of a run , restoring it into any machine goes on from there.
+	memory is kept in pages shared between snapshots : a page that is the same as in the base snapshot , or all
+	zero , is not copied , so snapshots along one run cost the pages written in between. restoring copies the
+	registers and 64 KiB. devices keep their own state , see bus_snapshot of devices.h.
+*/
+#define VM_PAGE_SHIFT 10
+
+typedef std::array<unsigned char , 1 << VM_PAGE_SHIFT> vm_page;
+
+struct vm_snapshot
+{
+	unsigned char reg[8];
+	unsigned char F;
+	unsigned short SP;
+	unsigned short PC;
+	bool inte;
+	unsigned char int_mask;
+	unsigned char int_pending;
+	VM_STATUS status;
+	unsigned long long cycles;
+	unsigned long long instructions;
+	std::array<unsigned char , 256> ports;
+	std::array<std::shared_ptr<const vm_page> , (VM_MEMORY_SIZE >> VM_PAGE_SHIFT)> pages;
+};
+
+inline vm_snapshot vm_take_snapshot(const machine &m , const vm_snapshot *base = nullptr)
+{
+	static const std::shared_ptr<const vm_page> ZERO = std::make_shared<vm_page>(vm_page{});
+	vm_snapshot s;
+	std::copy(m.reg , m.reg + 8 , s.reg);
+	s.F = m.F;
+	s.SP = m.SP;
+	s.PC = m.PC;
+	s.inte = m.inte;
+	s.int_mask = m.int_mask;
+	s.int_pending = m.int_pending;
+	s.status = m.status;
+	s.cycles = m.cycles;
+	s.instructions = m.instructions;
+	s.ports = m.ports;
+	for(size_t i = 0 ; i < s.pages.size() ; i++)
+	{
+		const unsigned char *page = m.memory.data() + (i << VM_PAGE_SHIFT);
+		if(base != nullptr && std::equal(page , page + (1 << VM_PAGE_SHIFT) , base->pages[i]->begin()))
+			s.pages[i] = base->pages[i];
+		else if(std::equal(page , page + (1 << VM_PAGE_SHIFT) , ZERO->begin()))
+			s.pages[i] = ZERO;
+		else
+		{
+			auto copy = std::make_shared<vm_page>();
+			std::copy(page , page + (1 << VM_PAGE_SHIFT) , copy->begin());
+			s.pages[i] = std::move(copy);
+		}
+	}
+	return s;
+}
+
+// cache is the block cache that ran on m (m.cache when not given) , its blocks are dropped when the memory under them changes
+inline void vm_restore_snapshot(machine &m , const vm_snapshot &s , block_cache *cache = nullptr)
+{
+	if(cache == nullptr)
+		cache = m.cache;
+	std::copy(s.reg , s.reg + 8 , m.reg);
+	m.F = s.F;
+	m.SP = s.SP;
+	m.PC = s.PC;
+	m.inte = s.inte;
+	m.int_mask = s.int_mask;
+	m.int_pending = s.int_pending;
+	m.status = s.status;
+	m.cycles = s.cycles;
+	m.instructions = s.instructions;
+	m.ports = s.ports;
+	bool code_changed = false;
+	for(size_t i = 0 ; i < s.pages.size() ; i++)
+	{
+		unsigned char *page = m.memory.data() + (i << VM_PAGE_SHIFT);
+		if(cache != nullptr && !code_changed)
+			for(size_t line = i << (VM_PAGE_SHIFT - VM_LINE_SHIFT) ; line < (i + 1) << (VM_PAGE_SHIFT - VM_LINE_SHIFT) ; line++)
+				if(m.watch_lines[line] & VM_LINE_CODE)
+				{
+					code_changed = !std::equal(page , page + (1 << VM_PAGE_SHIFT) , s.pages[i]->begin());
+					break;
+				}
+		std::copy(s.pages[i]->begin() , s.pages[i]->end() , page);
+	}
+	if(code_changed)
+	{
+		vm_drop_blocks(*cache);
+		for(unsigned char &watch : m.watch_lines)
+			watch &= ~VM_LINE_CODE;
+	}
+}
+
+// vm_run stopping before the instruction at pc , to take a snapshot there
+inline VM_STATUS vm_run_to(machine &m , unsigned short pc , unsigned long long max_cycles)
+{
+	while(m.status == VM_RUNNING && m.cycles < max_cycles && m.PC != pc)
+	{
+		VM_HANDLERS[m.memory[m.PC++]](m);
+		m.instructions++;
+	}
+	return m.status;
+}
+
+/*===================================PROFILER======================================*/
+/*
+	vm_run_profiled is vm_run counting the runs and T-states of every address. CALL , Ccc and RST that push a return
+	address open a frame for the subroutine and RET or Rcc that pop one close it , every chain of frames is a node of
+	a tree. the T-states of an instruction are also added to its node under the region of its address , regions
+	are numbered by the caller (e.g. the label the address is under).
+*/
+#define VM_PROFILE_DEPTH 64 // deeper calls stay in the frame at this depth
+
+struct vm_profile_node
+{
+	int parent; // -1 for the root
+	unsigned short entry; // address the subroutine was called at
+	int depth;
+	std::vector<unsigned long long> cycles; // by region
+};
+
+struct vm_profile
+{
+	std::vector<unsigned long long> hits = std::vector<unsigned long long>(VM_MEMORY_SIZE);
+	std::vector<unsigned long long> cycles = std::vector<unsigned long long>(VM_MEMORY_SIZE);
+	std::vector<int> region = std::vector<int>(VM_MEMORY_SIZE); // of every address , set before the run
+	int regions = 1;
+	std::vector<vm_profile_node> nodes;
+	std::unordered_map<unsigned long long , int> children; // parent node << 16 | entry => node
+};
+
+inline int vm_profile_call(vm_profile &p , int node , unsigned short entry)
+{
+	auto found = p.children.emplace((unsigned long long)node << 16 | entry , p.nodes.size());
+	if(found.second)
+		p.nodes.push_back({ node , entry , p.nodes[node].depth + 1 , std::vector<unsigned long long>(p.regions) });
+	return found.first->second;
+}
+
+inline VM_STATUS vm_run_profiled(machine &m , unsigned long long max_cycles , vm_profile &p)
+{
+	if(p.nodes.empty())
+		p.nodes.push_back({ -1 , m.PC , 0 , std::vector<unsigned long long>(p.regions) });
+	int node = 0;
+	int hidden = 0; // calls below VM_PROFILE_DEPTH that did not get a frame
+	while(m.status == VM_RUNNING && m.cycles < max_cycles)
+	{
+		unsigned short pc = m.PC , sp = m.SP;
+		unsigned long long before = m.cycles;
+		unsigned char op = m.memory[m.PC++];
+		VM_HANDLERS[op](m);
+		m.instructions++;
+		unsigned long long spent = m.cycles - before;
+		p.hits[pc]++;
+		p.cycles[pc] += spent;
+		p.nodes[node].cycles[p.region[pc]] += spent;
+		if(m.SP == (unsigned short)(sp - 2) && (op == 0xCD || (op & 0xC7) == 0xC4 || (op & 0xC7) == 0xC7))
+		{
+			if(p.nodes[node].depth < VM_PROFILE_DEPTH)
+				node = vm_profile_call(p , node , m.PC);
+			else
+				hidden++;
+		}
+		else if(m.SP == (unsigned short)(sp + 2) && (op == 0xC9 || (op & 0xC7) == 0xC0))
+		{
+			if(hidden > 0)
+				hidden--;
+			else if(p.nodes[node].parent >= 0)
+				node = p.nodes[node].parent;
+		}
+	}
+	return m.status;
+}
+
+#endif